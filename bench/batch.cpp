@@ -0,0 +1,105 @@
+/*******************************************************************
+
+File: batch.cpp
+
+Usage:	Cost of building a multi-row INSERT with BatchInsertStatement.
+	The statement has no connection and a flush size it never
+	reaches, so only the request building is timed.
+
+*******************************************************************/
+
+#include "benchmark.h"
+#include "sqlDatabase.h"
+
+#include <climits>
+#include <cstdint>
+
+static const int entriesPerBatch = 1000;
+
+static void BM_BatchInsertBuild( bench::State &state )
+{
+	const std::string name = "a name with an ' in it";
+	size_t bytes = 0;
+	while( state.keepRunning() )
+	{
+		sql::BatchInsertStatement batch( sql::Connection(), "bench_rows", UINT_MAX );
+		batch.addField( "id" );
+		batch.addField( "name" );
+		batch.addField( "score" );
+		batch.addField( "active" );
+		batch.addField( "created" );
+		batch.start();
+		for( int i = 0; i < entriesPerBatch; i++ )
+		{
+			batch.beginEntry();
+			batch.putInt( i );
+			batch.putString( name );
+			batch.putDouble( i * 0.25 );
+			batch.putBool( i % 2 == 0 );
+			batch.putLong( 1500000000LL + i );
+			batch.endEntry();
+		}
+		bytes = batch.getPendingBytes();
+		bench::doNotOptimize( batch.getPendingInserts() );
+	}
+	state.setBytesPerIteration( bytes );
+	state.setItemsPerIteration( entriesPerBatch );
+}
+SQL_BENCHMARK( BM_BatchInsertBuild );
+
+static void BM_BatchInsertDates( bench::State &state )
+{
+	size_t bytes = 0;
+	while( state.keepRunning() )
+	{
+		sql::BatchInsertStatement batch( sql::Connection(), "bench_rows", UINT_MAX );
+		batch.addField( "id" );
+		batch.addField( "created" );
+		batch.start();
+		for( int i = 0; i < entriesPerBatch; i++ )
+		{
+			batch.beginEntry();
+			batch.putInt( i );
+			batch.putDate( 1500000000 + i * 61 );
+			batch.endEntry();
+		}
+		bytes = batch.getPendingBytes();
+		bench::doNotOptimize( batch.getPendingInserts() );
+	}
+	state.setBytesPerIteration( bytes );
+	state.setItemsPerIteration( entriesPerBatch );
+}
+SQL_BENCHMARK( BM_BatchInsertDates );
+
+//The same rows as BM_BatchInsertBuild, written as the tab separated text BulkLoader sends.
+static void BM_BulkLoaderBuild( bench::State &state )
+{
+	const std::string name = "a name with an ' in it";
+	size_t bytes = 0;
+	while( state.keepRunning() )
+	{
+		sql::BulkLoader loader( sql::Connection(), "bench_rows" );
+		loader.setBytesPerFlush( SIZE_MAX );
+		loader.addField( "id" );
+		loader.addField( "name" );
+		loader.addField( "score" );
+		loader.addField( "active" );
+		loader.addField( "created" );
+		loader.start();
+		for( int i = 0; i < entriesPerBatch; i++ )
+		{
+			loader.beginEntry();
+			loader.putInt( i );
+			loader.putString( name );
+			loader.putDouble( i * 0.25 );
+			loader.putBool( i % 2 == 0 );
+			loader.putLong( 1500000000LL + i );
+			loader.endEntry();
+		}
+		bytes = loader.getPendingBytes();
+		bench::doNotOptimize( bytes );
+	}
+	state.setBytesPerIteration( bytes );
+	state.setItemsPerIteration( entriesPerBatch );
+}
+SQL_BENCHMARK( BM_BulkLoaderBuild );
@@ -0,0 +1,106 @@
+#ifndef SQL_BENCHMARK_H
+#define SQL_BENCHMARK_H
+
+/*******************************************************************
+
+File: benchmark.h
+
+Usage:	A small benchmark harness for the sqlDatabase hot paths. It has
+	no dependencies beyond the standard library, so the suite builds
+	anywhere the library itself does.
+
+	void BM_Something( bench::State &state )
+	{
+		while( state.keepRunning() )
+			bench::doNotOptimize( work() );
+		state.setItemsPerIteration( 1 );
+	}
+	SQL_BENCHMARK( BM_Something );
+
+*******************************************************************/
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+namespace bench
+{
+
+class State
+{
+private:
+	size_t iterations;
+	size_t remaining;
+	size_t bytesPerIteration;
+	size_t itemsPerIteration;
+	std::string skipReason;
+public:
+	explicit State( const size_t iterations )
+	{
+		this->iterations = iterations;
+		this->remaining = iterations;
+		this->bytesPerIteration = 0;
+		this->itemsPerIteration = 0;
+	}
+
+	//True until the loop has run the number of iterations being timed.
+	bool keepRunning()
+	{
+		if( remaining == 0 )
+			return false;
+		--remaining;
+		return true;
+	}
+	size_t getIterations() const { return iterations; }
+
+	//Used to report throughput alongside the time per iteration.
+	void setBytesPerIteration( const size_t bytes ) { bytesPerIteration = bytes; }
+	void setItemsPerIteration( const size_t items ) { itemsPerIteration = items; }
+	size_t getBytesPerIteration() const { return bytesPerIteration; }
+	size_t getItemsPerIteration() const { return itemsPerIteration; }
+
+	//Give up on the benchmark, such as when there is no server to run it against.
+	void skip( const std::string &reason ) { skipReason = reason; remaining = 0; }
+	const std::string &getSkipReason() const { return skipReason; }
+};
+
+typedef void (*BenchmarkFunction)( State & );
+
+struct Benchmark
+{
+	const char *name;
+	BenchmarkFunction function;
+};
+
+//Every benchmark registered with SQL_BENCHMARK, in the order they were registered.
+inline std::vector< Benchmark > &registeredBenchmarks()
+{
+	static std::vector< Benchmark > benchmarks;
+	return benchmarks;
+}
+
+struct Registration
+{
+	Registration( const char *name, BenchmarkFunction function )
+	{
+		registeredBenchmarks().push_back( Benchmark{ name, function } );
+	}
+};
+
+#define SQL_BENCHMARK( function ) static bench::Registration function##Registration( #function, function )
+
+//Keep the compiler from discarding a value that is computed but never used.
+template< typename T >
+inline void doNotOptimize( const T &value )
+{
+#if defined(__GNUC__) || defined(__clang__)
+	asm volatile( "" : : "r,m"( value ) : "memory" );
+#else
+	static volatile const void *sink;
+	sink = &value;
+#endif
+}
+
+}
+
+#endif
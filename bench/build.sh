@@ -0,0 +1,5 @@
+#!/bin/bash
+#Builds the benchmark suite, with the library sources compiled in, as ./sqlBenchmark.
+#	Run it from this directory, then ./sqlBenchmark [filter]
+CLIENT_LIBS=$(mysql_config --libs 2>/dev/null || echo "-lmysqlclient")
+g++ -std=c++2a -O2 -DNDEBUG -Wformat-security -Wformat -Wpointer-arith -Wcast-align -Wredundant-decls -Wcatch-value -Wpedantic -Wall -Werror -I/usr/local/include -I../mysql -o ./sqlBenchmark ../mysql/sqlDatabase.cpp main.cpp escape.cpp batch.cpp rows.cpp server.cpp $CLIENT_LIBS -pthread
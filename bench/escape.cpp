@@ -0,0 +1,92 @@
+/*******************************************************************
+
+File: escape.cpp
+
+Usage:	Throughput of the string escaping used by every statement
+	that carries user values.
+
+*******************************************************************/
+
+#include "benchmark.h"
+#include "sqlDatabase.h"
+
+//Text with a quote, backslash or NUL every fifty bytes or so, which is heavier than most real data.
+static std::string makeText( const size_t length )
+{
+	std::string text;
+	text.reserve( length );
+	for( size_t i = 0; i < length; i++ )
+	{
+		if( i % 53 == 7 )
+			text += '\'';
+		else if( i % 97 == 11 )
+			text += '\\';
+		else if( i % 211 == 13 )
+			text += '\0';
+		else
+			text += (char)( 'a' + i % 26 );
+	}
+	return text;
+}
+
+static void BM_EscapeStringShort( bench::State &state )
+{
+	const std::string text = makeText( 24 );
+	while( state.keepRunning() )
+		bench::doNotOptimize( sql::escapeString( text ) );
+	state.setBytesPerIteration( text.size() );
+}
+SQL_BENCHMARK( BM_EscapeStringShort );
+
+static void BM_EscapeStringLong( bench::State &state )
+{
+	const std::string text = makeText( 64 * 1024 );
+	while( state.keepRunning() )
+		bench::doNotOptimize( sql::escapeString( text ) );
+	state.setBytesPerIteration( text.size() );
+}
+SQL_BENCHMARK( BM_EscapeStringLong );
+
+//Appending into a buffer that is reused, the way BatchInsertStatement builds its request.
+static void BM_AppendEscapedShort( bench::State &state )
+{
+	const std::string text = makeText( 24 );
+	std::string buffer;
+	while( state.keepRunning() )
+	{
+		buffer.clear();
+		sql::appendEscapedString( buffer, text.c_str(), text.size() );
+		bench::doNotOptimize( buffer );
+	}
+	state.setBytesPerIteration( text.size() );
+}
+SQL_BENCHMARK( BM_AppendEscapedShort );
+
+static void BM_AppendEscapedLong( bench::State &state )
+{
+	const std::string text = makeText( 64 * 1024 );
+	std::string buffer;
+	while( state.keepRunning() )
+	{
+		buffer.clear();
+		sql::appendEscapedString( buffer, text.c_str(), text.size() );
+		bench::doNotOptimize( buffer );
+	}
+	state.setBytesPerIteration( text.size() );
+}
+SQL_BENCHMARK( BM_AppendEscapedLong );
+
+static void BM_QueryTemplateBuild( bench::State &state )
+{
+	sql::QueryTemplate statement( "UPDATE accounts SET name = ?, balance = ?, updated = ? WHERE id = ?" );
+	const std::string name = makeText( 24 );
+	size_t bytes = 0;
+	while( state.keepRunning() )
+	{
+		std::string text = statement.build( name, 1024.5, 12345678, 42 );
+		bytes = text.size();
+		bench::doNotOptimize( text );
+	}
+	state.setBytesPerIteration( bytes );
+}
+SQL_BENCHMARK( BM_QueryTemplateBuild );
@@ -0,0 +1,70 @@
+/*******************************************************************
+
+File: main.cpp
+
+Usage:	Runs every registered benchmark whose name contains the filter
+	given on the command line, or all of them. Each runs for at
+	least SQL_BENCH_MIN_TIME seconds (0.5 by default).
+
+	./sqlBenchmark [filter]
+
+*******************************************************************/
+
+#include "benchmark.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static double runOnce( const bench::Benchmark &benchmark, bench::State &state )
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	benchmark.function( state );
+	return std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+}
+
+int main( int argc, char **argv )
+{
+	const char *filter = argc > 1 ? argv[1] : "";
+	const char *minTimeSetting = getenv( "SQL_BENCH_MIN_TIME" );
+	const double minTime = minTimeSetting ? atof( minTimeSetting ) : 0.5;
+
+	printf( "%-36s %14s %14s %12s %14s\n", "Benchmark", "Iterations", "ns/iteration", "MB/s", "items/s" );
+	for( const bench::Benchmark &benchmark : bench::registeredBenchmarks() )
+	{
+		if( !strstr( benchmark.name, filter ) )
+			continue;
+
+		//Grow the iteration count until one run takes long enough to time reliably.
+		size_t iterations = 1;
+		double seconds = 0;
+		while( true )
+		{
+			bench::State state( iterations );
+			seconds = runOnce( benchmark, state );
+			if( !state.getSkipReason().empty() )
+			{
+				printf( "%-36s skipped: %s\n", benchmark.name, state.getSkipReason().c_str() );
+				break;
+			}
+			if( seconds >= minTime || iterations >= ((size_t)1 << 40) )
+			{
+				double nanoseconds = seconds * 1e9 / (double)iterations;
+				double megabytes = (double)state.getBytesPerIteration() * (double)iterations / seconds / (1024.0 * 1024.0);
+				double items = (double)state.getItemsPerIteration() * (double)iterations / seconds;
+				printf( "%-36s %14zu %14.1f %12.1f %14.0f\n", benchmark.name, iterations, nanoseconds, megabytes, items );
+				break;
+			}
+			//Aim a little past the minimum time, but never grow by more than ten times at once.
+			double scale = seconds > 0 ? (minTime * 1.4) / seconds : 10.0;
+			if( scale > 10.0 )
+				scale = 10.0;
+			if( scale < 1.5 )
+				scale = 1.5;
+			iterations = (size_t)((double)iterations * scale) + 1;
+		}
+		fflush( stdout );
+	}
+	return 0;
+}
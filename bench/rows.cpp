@@ -0,0 +1,292 @@
+/*******************************************************************
+
+File: rows.cpp
+
+Usage:	Field lookup, the column text parsers and the row getters.
+	Results come from MaterializedResult::create() or from rows
+	built by hand, so no server is needed.
+
+*******************************************************************/
+
+#include "benchmark.h"
+#include "sqlDatabase.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+static const int resultRows = 10000;
+
+static std::vector< std::string > makeFieldNames()
+{
+	std::vector< std::string > names;
+	const char *common[] = { "id", "account_id", "name", "email", "created", "updated", "balance", "status",
+		"country", "region", "city", "postcode", "phone", "notes", "flags", "owner_id" };
+	for( const char *name : common )
+		names.push_back( name );
+	return names;
+}
+
+//A result shaped like a typical table, a minute apart by creation time, with every tenth email NULL.
+static sql::MaterializedResult makeResult()
+{
+	std::vector< std::string > fields = { "id", "name", "email", "balance", "created" };
+	std::vector< std::vector< std::optional< std::string > > > values;
+	values.reserve( resultRows );
+	char created[32];
+	for( int i = 0; i < resultRows; i++ )
+	{
+		snprintf( created, sizeof(created), "2023-06-%02d %02d:%02d:%02d", 1 + i / 1440, (i / 60) % 24, i % 60, (i * 7) % 60 );
+		std::optional< std::string > email;
+		if( i % 10 != 0 )
+			email = "user" + std::to_string( i ) + "@example.com";
+		values.push_back( { std::to_string( i ), "name " + std::to_string( i ), email, std::to_string( i * 1.5 ), std::string( created ) } );
+	}
+	return sql::_MaterializedResult::create( fields, values );
+}
+
+static void BM_FieldSetFind( bench::State &state )
+{
+	std::vector< std::string > names = makeFieldNames();
+	sql::sqlFieldSet fields;
+	for( const std::string &name : names )
+		fields.add( name );
+	size_t next = 0;
+	while( state.keepRunning() )
+	{
+		bench::doNotOptimize( fields.find( names[ next ] ) );
+		if( ++next == names.size() )
+			next = 0;
+	}
+	state.setItemsPerIteration( 1 );
+}
+SQL_BENCHMARK( BM_FieldSetFind );
+
+static void BM_FieldSetFindMissing( bench::State &state )
+{
+	sql::sqlFieldSet fields;
+	for( const std::string &name : makeFieldNames() )
+		fields.add( name );
+	const std::string missing = "no_such_field";
+	while( state.keepRunning() )
+		bench::doNotOptimize( fields.find( missing ) );
+	state.setItemsPerIteration( 1 );
+}
+SQL_BENCHMARK( BM_FieldSetFindMissing );
+
+static void BM_ParseInteger( bench::State &state )
+{
+	const char *text = "-1234567890";
+	const size_t length = strlen( text );
+	while( state.keepRunning() )
+		bench::doNotOptimize( sql::parseInteger< long long >( text, length ) );
+	state.setBytesPerIteration( length );
+}
+SQL_BENCHMARK( BM_ParseInteger );
+
+//The C library call the parsers replaced, for comparison.
+static void BM_ParseIntegerStrtoll( bench::State &state )
+{
+	const char *text = "-1234567890";
+	while( state.keepRunning() )
+		bench::doNotOptimize( strtoll( text, NULL, 10 ) );
+	state.setBytesPerIteration( strlen( text ) );
+}
+SQL_BENCHMARK( BM_ParseIntegerStrtoll );
+
+static void BM_ParseDouble( bench::State &state )
+{
+	const char *text = "-12345.6789";
+	const size_t length = strlen( text );
+	while( state.keepRunning() )
+		bench::doNotOptimize( sql::parseDouble( text, length ) );
+	state.setBytesPerIteration( length );
+}
+SQL_BENCHMARK( BM_ParseDouble );
+
+static void BM_ParseDoubleAtof( bench::State &state )
+{
+	const char *text = "-12345.6789";
+	while( state.keepRunning() )
+		bench::doNotOptimize( atof( text ) );
+	state.setBytesPerIteration( strlen( text ) );
+}
+SQL_BENCHMARK( BM_ParseDoubleAtof );
+
+static void BM_ParseTimestamp( bench::State &state )
+{
+	const char *text = "2023-06-15 13:45:30";
+	const size_t length = strlen( text );
+	while( state.keepRunning() )
+		bench::doNotOptimize( sql::parseTimestamp( text, length ) );
+	state.setBytesPerIteration( length );
+}
+SQL_BENCHMARK( BM_ParseTimestamp );
+
+static void BM_ParseTimestampMktime( bench::State &state )
+{
+	const char *text = "2023-06-15 13:45:30";
+	while( state.keepRunning() )
+	{
+		struct tm time;
+		memset( &time, 0, sizeof(time) );
+		sscanf( text, "%d-%d-%d %d:%d:%d", &time.tm_year, &time.tm_mon, &time.tm_mday, &time.tm_hour, &time.tm_min, &time.tm_sec );
+		time.tm_year -= 1900;
+		time.tm_mon -= 1;
+		time.tm_isdst = -1;
+		bench::doNotOptimize( mktime( &time ) );
+	}
+	state.setBytesPerIteration( strlen( text ) );
+}
+SQL_BENCHMARK( BM_ParseTimestampMktime );
+
+//Row getters by index over a row built by hand, which is how the library hands them out.
+static void BM_RowGetters( bench::State &state )
+{
+	char id[] = "123456";
+	char name[] = "a short name";
+	char balance[] = "1024.75";
+	char created[] = "2023-06-15 13:45:30";
+	char *cells[] = { id, name, nullptr, balance, created };
+	const unsigned long lengths[] = { sizeof(id) - 1, sizeof(name) - 1, 0, sizeof(balance) - 1, sizeof(created) - 1 };
+	sql::Row row( nullptr, cells, lengths );
+	while( state.keepRunning() )
+	{
+		bench::doNotOptimize( row.getInt( 0 ) );
+		bench::doNotOptimize( row.getStringView( 1 ) );
+		bench::doNotOptimize( row.getNullableString( 2 ) );
+		bench::doNotOptimize( row.getDouble( 3 ) );
+		bench::doNotOptimize( row.getTimestamp( 4 ) );
+	}
+	state.setItemsPerIteration( 1 );
+}
+SQL_BENCHMARK( BM_RowGetters );
+
+static void BM_MaterializedResultCreate( bench::State &state )
+{
+	std::vector< std::string > fields = { "id", "name" };
+	std::vector< std::vector< std::optional< std::string > > > values;
+	for( int i = 0; i < 1000; i++ )
+		values.push_back( { std::to_string( i ), "name " + std::to_string( i ) } );
+	while( state.keepRunning() )
+		bench::doNotOptimize( sql::_MaterializedResult::create( fields, values ) );
+	state.setItemsPerIteration( values.size() );
+}
+SQL_BENCHMARK( BM_MaterializedResultCreate );
+
+//A full pass over a result through Column handles, the way a loop over a query should read it.
+static void BM_MaterializedScan( bench::State &state )
+{
+	sql::MaterializedResult result = makeResult();
+	sql::Column id = result->getColumn( "id" );
+	sql::Column email = result->getColumn( "email" );
+	sql::Column balance = result->getColumn( "balance" );
+	sql::Column created = result->getColumn( "created" );
+	while( state.keepRunning() )
+	{
+		long long ids = 0;
+		double total = 0;
+		size_t emails = 0;
+		time_t latest = 0;
+		for( unsigned int i = 0; i < result->numRows(); i++ )
+		{
+			sql::MaterializedRow row = result->getRow( i );
+			ids += row.getLongLong( id );
+			total += row.getDouble( balance );
+			emails += !row.isFieldNull( email );
+			time_t when = row.getTimestamp( created );
+			if( when > latest )
+				latest = when;
+		}
+		bench::doNotOptimize( ids );
+		bench::doNotOptimize( total );
+		bench::doNotOptimize( emails );
+		bench::doNotOptimize( latest );
+	}
+	state.setItemsPerIteration( result->numRows() );
+}
+SQL_BENCHMARK( BM_MaterializedScan );
+
+//The same pass looking every field up by name, to show what the Column handles save.
+static void BM_MaterializedScanByName( bench::State &state )
+{
+	sql::MaterializedResult result = makeResult();
+	while( state.keepRunning() )
+	{
+		long long ids = 0;
+		double total = 0;
+		for( unsigned int i = 0; i < result->numRows(); i++ )
+		{
+			sql::MaterializedRow row = result->getRow( i );
+			ids += row.getLongLong( "id" );
+			total += row.getDouble( "balance" );
+		}
+		bench::doNotOptimize( ids );
+		bench::doNotOptimize( total );
+	}
+	state.setItemsPerIteration( result->numRows() );
+}
+SQL_BENCHMARK( BM_MaterializedScanByName );
+
+//The same aggregate as BM_MaterializedScan, reading the columns into vectors first and
+//	then looping over those.
+static void extractAndAggregate( bench::State &state, const unsigned int threads )
+{
+	sql::MaterializedResult result = makeResult();
+	std::array< sql::Column, 4 > columns = { result->getColumn( "id" ), result->getColumn( "email" ),
+		result->getColumn( "balance" ), result->getColumn( "created" ) };
+	while( state.keepRunning() )
+	{
+		auto [ids, emails, balances, created] = result->extractColumns< long long, std::string_view, double, sql::Timestamp >( columns, threads );
+		long long idTotal = 0;
+		double total = 0;
+		time_t latest = 0;
+		for( size_t i = 0; i < ids.size(); i++ )
+		{
+			idTotal += ids[ i ];
+			total += balances[ i ];
+			if( created[ i ] > latest )
+				latest = created[ i ];
+		}
+		bench::doNotOptimize( idTotal );
+		bench::doNotOptimize( total );
+		bench::doNotOptimize( emails.size() - emails.nullCount() );
+		bench::doNotOptimize( latest );
+	}
+	state.setItemsPerIteration( result->numRows() );
+}
+static void BM_ExtractColumns( bench::State &state )
+{
+	extractAndAggregate( state, 1 );
+}
+SQL_BENCHMARK( BM_ExtractColumns );
+static void BM_ExtractColumnsThreaded( bench::State &state )
+{
+	extractAndAggregate( state, 0 );
+}
+SQL_BENCHMARK( BM_ExtractColumnsThreaded );
+
+//Mapping a saved snapshot back in, including the checksum over every byte.
+static void BM_SnapshotOpen( bench::State &state )
+{
+	sql::MaterializedResult result = makeResult();
+	const std::string path = "sqlBenchmark-snapshot";
+	try
+	{
+		result->save( path );
+	}
+	catch( sql::Exception &e )
+	{
+		state.skip( "the snapshot could not be written to the working directory" );
+		return;
+	}
+	while( state.keepRunning() )
+	{
+		sql::MaterializedResult snapshot = sql::_MaterializedResult::open( path );
+		bench::doNotOptimize( snapshot->getRow( snapshot->numRows() - 1 ).getLongLong( 0 ) );
+	}
+	remove( path.c_str() );
+	state.setBytesPerIteration( result->getMemoryUsage() );
+}
+SQL_BENCHMARK( BM_SnapshotOpen );
@@ -0,0 +1,239 @@
+/*******************************************************************
+
+File: server.cpp
+
+Usage:	Round trips against a real server. These are skipped unless
+	SQL_BENCH_HOST is set, along with SQL_BENCH_USER,
+	SQL_BENCH_PASSWORD and SQL_BENCH_DATABASE as needed. The
+	tables used are temporary and go away with the connection.
+
+*******************************************************************/
+
+#include "benchmark.h"
+#include "sqlDatabase.h"
+
+#include <cstdlib>
+
+static const int tableRows = 10000;
+static const int entriesPerBatch = 1000;
+
+static std::string getSetting( const char *name )
+{
+	const char *value = getenv( name );
+	return value ? value : "";
+}
+
+static sql::Connection openConnection()
+{
+	sql::Connection connection = std::make_shared< sql::_Connection >();
+	connection->setLocalInfile( true );
+	connection->connect( getSetting( "SQL_BENCH_HOST" ), getSetting( "SQL_BENCH_USER" ), getSetting( "SQL_BENCH_PASSWORD" ), getSetting( "SQL_BENCH_DATABASE" ) );
+	connection->sendRawQuery( "CREATE TEMPORARY TABLE bench_inserts( id INT, name VARCHAR(64), balance DOUBLE, created DATETIME )" );
+	return connection;
+}
+
+//One connection shared by the server benchmarks, with bench_rows filled on first use.
+//	Returns an empty connection, and skips the benchmark, when no server is configured.
+static sql::Connection getConnection( bench::State &state )
+{
+	static sql::Connection connection;
+	static bool attempted = false;
+	if( !attempted )
+	{
+		attempted = true;
+		if( getSetting( "SQL_BENCH_HOST" ).empty() )
+		{
+			state.skip( "SQL_BENCH_HOST is not set" );
+			return connection;
+		}
+		try
+		{
+			sql::Connection server = openConnection();
+			server->sendRawQuery( "CREATE TEMPORARY TABLE bench_rows( id INT PRIMARY KEY, name VARCHAR(64), balance DOUBLE, created DATETIME )" );
+
+			sql::BatchInsertStatement batch( server, "bench_rows", entriesPerBatch );
+			batch.addField( "id" );
+			batch.addField( "name" );
+			batch.addField( "balance" );
+			batch.addField( "created" );
+			batch.start();
+			for( int i = 0; i < tableRows; i++ )
+			{
+				batch.beginEntry();
+				batch.putInt( i );
+				batch.putString( "name " + std::to_string( i ) );
+				batch.putDouble( i * 1.5 );
+				batch.putDate( 1500000000 + i * 61 );
+				batch.endEntry();
+			}
+			batch.finish();
+			connection = server;
+		}
+		catch( sql::Exception &e )
+		{
+			e.report();
+		}
+	}
+	if( !connection )
+		state.skip( "no server connection" );
+	return connection;
+}
+
+static void BM_ServerSelectOne( bench::State &state )
+{
+	sql::Connection connection = getConnection( state );
+	while( state.keepRunning() )
+		bench::doNotOptimize( connection->sendQuery( "SELECT 1" ) );
+	state.setItemsPerIteration( 1 );
+}
+SQL_BENCHMARK( BM_ServerSelectOne );
+
+//Sending a query and reading every row of the result.
+static void BM_ServerRowIngest( bench::State &state )
+{
+	sql::Connection connection = getConnection( state );
+	while( state.keepRunning() )
+	{
+		sql::Query query = connection->sendQuery( "SELECT id, name, balance, created FROM bench_rows" );
+		sql::Column id = query->getColumn( "id" );
+		sql::Column balance = query->getColumn( "balance" );
+		long long ids = 0;
+		double total = 0;
+		for( sql::RowView row : *query )
+		{
+			ids += row.getLongLong( id );
+			total += row.getDouble( balance );
+		}
+		bench::doNotOptimize( ids );
+		bench::doNotOptimize( total );
+	}
+	state.setItemsPerIteration( tableRows );
+}
+SQL_BENCHMARK( BM_ServerRowIngest );
+
+static void BM_ServerStreamIngest( bench::State &state )
+{
+	sql::Connection connection = getConnection( state );
+	while( state.keepRunning() )
+	{
+		sql::Query query = connection->streamQuery( "SELECT id, name, balance, created FROM bench_rows" );
+		long long ids = 0;
+		while( query->hasNextRow() )
+			ids += query->getRow().getLongLong( 0 );
+		bench::doNotOptimize( ids );
+	}
+	state.setItemsPerIteration( tableRows );
+}
+SQL_BENCHMARK( BM_ServerStreamIngest );
+
+static void BM_ServerPreparedSelect( bench::State &state )
+{
+	sql::Connection connection = getConnection( state );
+	if( !connection )
+		return;
+	sql::PreparedStatement statement = connection->prepareStatement( "SELECT name, balance FROM bench_rows WHERE id = ?" );
+	int next = 0;
+	while( state.keepRunning() )
+	{
+		statement->setInt( 0, next );
+		statement->execute();
+		while( statement->fetch() )
+			bench::doNotOptimize( statement->getDouble( 1 ) );
+		if( ++next == tableRows )
+			next = 0;
+	}
+	state.setItemsPerIteration( 1 );
+}
+SQL_BENCHMARK( BM_ServerPreparedSelect );
+
+static void BM_ServerBatchInsert( bench::State &state )
+{
+	sql::Connection connection = getConnection( state );
+	if( !connection )
+		return;
+	while( state.keepRunning() )
+	{
+		sql::BatchInsertStatement batch( connection, "bench_inserts", entriesPerBatch );
+		batch.addField( "id" );
+		batch.addField( "name" );
+		batch.addField( "balance" );
+		batch.addField( "created" );
+		batch.start();
+		for( int i = 0; i < entriesPerBatch; i++ )
+		{
+			batch.beginEntry();
+			batch.putInt( i );
+			batch.putString( "name" );
+			batch.putDouble( i * 1.5 );
+			batch.putDate( 1500000000 + i );
+			batch.endEntry();
+		}
+		batch.finish();
+	}
+	connection->sendRawQuery( "TRUNCATE TABLE bench_inserts" );
+	state.setItemsPerIteration( entriesPerBatch );
+}
+SQL_BENCHMARK( BM_ServerBatchInsert );
+
+static void BM_ServerBulkLoad( bench::State &state )
+{
+	sql::Connection connection = getConnection( state );
+	if( !connection )
+		return;
+	while( state.keepRunning() )
+	{
+		sql::BulkLoader loader( connection, "bench_inserts" );
+		loader.addField( "id" );
+		loader.addField( "name" );
+		loader.addField( "balance" );
+		loader.addField( "created" );
+		loader.start();
+		for( int i = 0; i < tableRows; i++ )
+		{
+			loader.beginEntry();
+			loader.putInt( i );
+			loader.putString( "name" );
+			loader.putDouble( i * 1.5 );
+			loader.putDate( 1500000000 + i );
+			loader.endEntry();
+		}
+		loader.finish();
+	}
+	connection->sendRawQuery( "TRUNCATE TABLE bench_inserts" );
+	state.setItemsPerIteration( tableRows );
+}
+SQL_BENCHMARK( BM_ServerBulkLoad );
+
+//The same inserts as BM_ServerBatchInsert, sent by a worker connection while the next batch is built.
+static void BM_ServerPipelinedInsert( bench::State &state )
+{
+	sql::Connection connection = getConnection( state );
+	if( !connection )
+		return;
+	//Temporary tables belong to one connection, so the worker needs its own.
+	sql::Connection worker = openConnection();
+	sql::PipelineOptions options;
+	const int batches = 10;
+	while( state.keepRunning() )
+	{
+		sql::BatchInsertStatement batch( worker, "bench_inserts", entriesPerBatch, options );
+		batch.addField( "id" );
+		batch.addField( "name" );
+		batch.addField( "balance" );
+		batch.addField( "created" );
+		batch.start();
+		for( int i = 0; i < entriesPerBatch * batches; i++ )
+		{
+			batch.beginEntry();
+			batch.putInt( i );
+			batch.putString( "name" );
+			batch.putDouble( i * 1.5 );
+			batch.putDate( 1500000000 + i );
+			batch.endEntry();
+		}
+		batch.finish();
+	}
+	worker->sendRawQuery( "TRUNCATE TABLE bench_inserts" );
+	state.setItemsPerIteration( entriesPerBatch * batches );
+}
+SQL_BENCHMARK( BM_ServerPipelinedInsert );
@@ -0,0 +1,51 @@
+# Finds the MySQL or MariaDB client library.
+#
+# Sets MySQLClient_FOUND, MySQLClient_INCLUDE_DIRS and MySQLClient_LIBRARIES, and
+# defines the imported target MySQLClient::MySQLClient. MySQLClient_INCLUDE_DIR is the
+# directory holding mysql/mysql.h, since that is how sqlDatabase.h includes it.
+# MySQLClient_ROOT, or the cache variables below, can point at a client elsewhere.
+
+find_package(PkgConfig QUIET)
+if(PKG_CONFIG_FOUND)
+	pkg_search_module(PC_MySQLClient QUIET mysqlclient libmariadb mariadb)
+endif()
+
+set(_MySQLClient_include_hints)
+foreach(_dir IN LISTS PC_MySQLClient_INCLUDE_DIRS)
+	get_filename_component(_parent "${_dir}" DIRECTORY)
+	list(APPEND _MySQLClient_include_hints "${_dir}" "${_parent}")
+endforeach()
+
+find_path(MySQLClient_INCLUDE_DIR
+	NAMES mysql/mysql.h
+	HINTS ${_MySQLClient_include_hints}
+	PATHS /usr/local/include /usr/include)
+
+find_library(MySQLClient_LIBRARY
+	NAMES mysqlclient mariadb mariadbclient
+	HINTS ${PC_MySQLClient_LIBRARY_DIRS}
+	PATH_SUFFIXES mysql mariadb)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(MySQLClient
+	REQUIRED_VARS MySQLClient_LIBRARY MySQLClient_INCLUDE_DIR
+	VERSION_VAR PC_MySQLClient_VERSION)
+
+if(MySQLClient_FOUND)
+	set(MySQLClient_INCLUDE_DIRS "${MySQLClient_INCLUDE_DIR}")
+	set(MySQLClient_LIBRARIES "${MySQLClient_LIBRARY}")
+	if(NOT TARGET MySQLClient::MySQLClient)
+		add_library(MySQLClient::MySQLClient UNKNOWN IMPORTED)
+		set_target_properties(MySQLClient::MySQLClient PROPERTIES
+			IMPORTED_LOCATION "${MySQLClient_LIBRARY}"
+			INTERFACE_INCLUDE_DIRECTORIES "${MySQLClient_INCLUDE_DIR}")
+		# A static client library also needs what it was linked against.
+		if(MySQLClient_LIBRARY MATCHES "\\.a$" AND PC_MySQLClient_STATIC_LIBRARIES)
+			list(REMOVE_ITEM PC_MySQLClient_STATIC_LIBRARIES mysqlclient mariadb)
+			set_property(TARGET MySQLClient::MySQLClient PROPERTY
+				INTERFACE_LINK_LIBRARIES ${PC_MySQLClient_STATIC_LIBRARIES})
+		endif()
+	endif()
+endif()
+
+mark_as_advanced(MySQLClient_INCLUDE_DIR MySQLClient_LIBRARY)
@@ -10,20 +10,94 @@ Author: Michael Mason - mikemason930@gmail.com (C) 01-26-2007
 
 #include "sqlDatabase.h"
 
-void insertLetterBeforeLetter(std::string &str, const char letter_to_find, const char letter_to_lead);
+#include <algorithm>
+#include <mysql/errmsg.h>
+#ifdef SQL_DATABASE_ASYNC
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <poll.h>
+#endif
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include <cstdio>
+#include <cerrno>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//MariaDB's client library spells the SSL options differently, and MySQL's has zstd from 8.0.18.
+#if defined(MARIADB_PACKAGE_VERSION_ID) || defined(MARIADB_BASE_VERSION)
+#define SQL_DATABASE_MARIADB
+#elif defined(LIBMYSQL_VERSION_ID) && LIBMYSQL_VERSION_ID >= 80018
+#define SQL_DATABASE_ZSTD
+#endif
 
 namespace sql
 {
 
-int _Query::numberOfAllocations=0;
-int _Query::numberOfDeallocations=0;
-int Row::numberOfAllocations=0;
-int Row::numberOfDeallocations=0;
+ShardedCounter _Query::numberOfAllocations;
+ShardedCounter _Query::numberOfDeallocations;
+ShardedCounter Row::numberOfAllocations;
+ShardedCounter Row::numberOfDeallocations;
+
+
+/************* Field Set Member Function Implementations ************/
+
+void sqlFieldSet::insert( const int index )
+{
+	size_t mask = slots.size() - 1;
+	for(size_t slot = hash( names[ index ] ) & mask;;slot = (slot + 1) & mask)
+	{
+		if( slots[ slot ] == -1 || names[ slots[ slot ] ] == names[ index ] )
+		{
+			slots[ slot ] = index;
+			return;
+		}
+	}
+}
+
+void sqlFieldSet::add( const std::string &name )
+{
+	names.push_back( name );
+
+	//Keep the table at most half full, so probes stay short.
+	if( slots.size() < names.size() * 2 )
+	{
+		size_t capacity = 16;
+		while( capacity < names.size() * 2 )
+			capacity *= 2;
+		slots.assign( capacity, -1 );
+		for(size_t i = 0;i < names.size();++i)
+			insert( (int)i );
+	}
+	else
+		insert( (int)names.size() - 1 );
+}
 
+void sqlFieldSet::clear()
+{
+	names.clear();
+	slots.clear();
+}
 
 Context createContext( const std::string &host, const std::string &user, const std::string &password, const std::string &databaseName )
 {
-	return Context( new _Context(host, user, password, databaseName) );
+	return std::make_shared< _Context >( host, user, password, databaseName );
+}
+Context createContext( const std::string &host, const std::string &user, const std::string &password, const std::string &databaseName, const ConnectionOptions &options )
+{
+	return std::make_shared< _Context >( host, user, password, databaseName, options );
 }
 
 _Context::_Context( const std::string &host, const std::string &user, const std::string &password, const std::string &databaseName )
@@ -32,8 +106,7 @@ _Context::_Context( const std::string &host, const std::string &user, const std:
 	this->user = user;
 	this->password = password;
 	this->databaseName = databaseName;
-	this->port = 0;
-	this->flags = 0;
+	this->localInfile = false;
 }
 _Context::_Context( const std::string &host, const std::string &user, const std::string &password, const std::string &databaseName, const int port )
 {
@@ -41,361 +114,3264 @@ _Context::_Context( const std::string &host, const std::string &user, const std:
 	this->user = user;
 	this->password = password;
 	this->databaseName = databaseName;
-	this->port = port;
-	this->flags = flags;
+	this->options.port = port;
+	this->localInfile = false;
+}
+_Context::_Context( const std::string &host, const std::string &user, const std::string &password, const std::string &databaseName, const int port, const int flags )
+{
+	this->host = host;
+	this->user = user;
+	this->password = password;
+	this->databaseName = databaseName;
+	this->options.port = port;
+	this->options.clientFlags = flags;
+	this->localInfile = ( flags & CLIENT_LOCAL_FILES ) != 0;
 }
-_Context::_Context( const std::string &Host, const std::string &user, const std::string &password, const std::string &databaseName, const int port, const int flags )
+_Context::_Context( const std::string &host, const std::string &user, const std::string &password, const std::string &databaseName, const ConnectionOptions &options )
 {
 	this->host = host;
 	this->user = user;
 	this->password = password;
 	this->databaseName = databaseName;
-	this->port = port;
-	this->flags = flags;
+	this->options = options;
+	this->localInfile = ( options.clientFlags & CLIENT_LOCAL_FILES ) != 0;
 }
 Connection _Context::createConnection()
 {
-	return Connection( new _Connection(host, user, password, databaseName) );
+	Connection connection = std::make_shared< _Connection >();
+	connection->setQueryCache( queryCache );
+	connection->setQueryProfiler( queryProfiler );
+	connection->setLocalInfile( localInfile );
+	connection->setOptions( options );
+	connection->connect( host, user, password, databaseName );
+	return connection;
 }
-
-_Connection::_Connection()
+ConnectionPool _Context::createConnectionPool( const unsigned int minSize, const unsigned int maxSize )
 {
-	server = mysql_init( 0 );
+	Context self = weak_from_this().lock();
+	if( !self )
+		throw ConnectionException("A connection pool can only be created from a context owned by a Context pointer.");
+
+	connectionPool = std::make_shared< _ConnectionPool >( self, minSize, maxSize );
+	return connectionPool;
 }
 
-_Connection::_Connection( const std::string &host, const std::string &user, const std::string &password, const std::string &name )
+WriteBehindQueue _Context::createWriteBehindQueue( const size_t capacity, std::function< void( const std::string &, QueryException & ) > errorCallback )
 {
-	server = mysql_init( 0 );
-
-	connect( host, user, password, name );
+	//Drop any previous queue first, so its statements run before the new queue's.
+	writeBehindQueue.reset();
+	writeBehindQueue = std::make_shared< _WriteBehindQueue >( createConnection(), capacity, errorCallback );
+	return writeBehindQueue;
 }
-_Connection::~_Connection()
+
+/************* Query Cache Member Function Implementations ************/
+
+_QueryCache::_QueryCache( const size_t maxBytes, const std::chrono::milliseconds defaultTtl )
 {
-	if ( server ) mysql_close( server );
+	this->maxBytes = maxBytes;
+	this->usedBytes = 0;
+	this->defaultTtl = defaultTtl;
+	this->hits = 0;
+	this->misses = 0;
+	this->evictions = 0;
 }
 
-void _Connection::connect( const std::string &host, const std::string &user, const std::string &password, const std::string &name )
+//Collapse each run of whitespace outside quotes to one space, and drop leading and trailing
+//	whitespace and semicolons, so that the same query written twice maps to the same entry.
+std::string _QueryCache::normalize( const std::string &queryBuffer )
 {
-	if(!mysql_real_connect(server, host.c_str(), user.c_str(), password.c_str(), name.c_str(),
-	0, 0, CLIENT_MULTI_STATEMENTS))
+	std::string key;
+	key.reserve( queryBuffer.size() );
+	char quote = 0;
+	bool pendingSpace = false;
+	for(size_t i = 0;i < queryBuffer.size();++i)
 	{
-		std::stringstream errorMessage;
-		errorMessage << "Failed to connect to database '" << name << "' as '" << user << "' @" << host;
-		throw ConnectionException( errorMessage.str() );
+		char c = queryBuffer[ i ];
+		if( quote )
+		{
+			key += c;
+			if( c == '\\' && i + 1 < queryBuffer.size() )
+				key += queryBuffer[ ++i ];
+			else if( c == quote )
+				quote = 0;
+			continue;
+		}
+		if( isspace( (unsigned char)c ) )
+		{
+			pendingSpace = !key.empty();
+			continue;
+		}
+		if( pendingSpace )
+		{
+			key += ' ';
+			pendingSpace = false;
+		}
+		if( c == '\'' || c == '"' || c == '`' )
+			quote = c;
+		key += c;
 	}
+	while( !quote && !key.empty() && (key.back() == ';' || key.back() == ' ') )
+		key.pop_back();
+	return key;
 }
 
-void _Connection::reportError()
+//An estimate of the memory held by a stored result: the cell data and the per-row bookkeeping.
+size_t _QueryCache::resultBytes( const _Query &query )
 {
-	std::cout << "SQL Error : " << mysql_error( server ) << std::endl;
+	size_t bytes = sizeof(_Query) + query.request.size();
+	for(size_t i = 0;i < query.lengths.size();++i)
+		bytes += query.lengths[ i ] + 1;
+	bytes += query.rows.size() * (sizeof(MYSQL_ROW) + query.fields.size() * (sizeof(char*) + sizeof(unsigned long)));
+	for(size_t i = 0;i < query.fields.size();++i)
+		bytes += query.fields.getName( (int)i ).size() + sizeof(MYSQL_FIELD);
+	return bytes;
 }
 
-void _Connection::reportError( const std::string &logMessage )
+void _QueryCache::erase( std::list< Entry >::iterator entry )
 {
-	std::cout << "SQL Error( " << mysql_error( server ) << " ) : " << logMessage << std::endl;
+	usedBytes -= entry->bytes;
+	index.erase( entry->key );
+	entries.erase( entry );
 }
 
-bool _Connection::isConnected()
+//Database names cannot hold a NUL, so the same text run against two databases never shares a key.
+std::string _QueryCache::makeKey( const std::string &database, const std::string &queryBuffer )
 {
-	return (server && mysql_ping(server) == 0);
+	std::string key = database;
+	key += '\0';
+	key += normalize( queryBuffer );
+	return key;
 }
 
-std::shared_ptr<_Query> _Connection::sendQuery( const std::string &queryBuffer )
+ConstQuery _QueryCache::find( const std::string &database, const std::string &queryBuffer )
 {
-	_Query *query = new _Query( queryBuffer, this );
-	Query wrappedQuery;
-	try {
-		wrappedQuery = query->send();
-	} catch( QueryException &e ) {
-		throw;
-	}
+	std::string key = makeKey( database, queryBuffer );
+	std::lock_guard< std::mutex > lock( mutex );
 
-	return wrappedQuery;
-}
-void _Connection::sendQuery( Query query )
-{
-	int retval;
-	//Nonzero return value means there was an error.
-	if( (retval = mysql_query( server, query->getQueryBuffer().c_str() )) != 0 )
+	std::map< std::string, std::list< Entry >::iterator >::iterator found = index.find( key );
+	if( found == index.end() )
 	{
-		std::stringstream errorMessage;
-		errorMessage << "Failed to send query. Errno: " << retval;
-		throw QueryException(errorMessage.str(),this->server, query->getQueryBuffer().c_str());
+		++misses;
+		return ConstQuery();
 	}
-	//There is no error reporting, because many queries do not store a result.
-	query->setResultSet( mysql_store_result( server ) );
-}
-
-//This method will simply send the query without storing a result, or an Query object.
-void _Connection::sendRawQuery( const std::string &query )
-{
-	int retval;
-	//Nonzero return value means there was an error.
-	if( (retval = mysql_query( server, query.c_str() )) != 0 )
+	std::list< Entry >::iterator entry = found->second;
+	if( entry->expires <= std::chrono::steady_clock::now() )
 	{
-		std::stringstream errorMessage;
-		errorMessage << "Failed to send query. Errno: " << retval;
-		throw QueryException(errorMessage.str(), this->server, query.c_str());
+		erase( entry );
+		++misses;
+		return ConstQuery();
 	}
+	entries.splice( entries.begin(), entries, entry );
+	++hits;
+	return entry->query;
 }
-my_ulonglong _Connection::lastInsertID()
+
+void _QueryCache::insert( const std::string &database, const std::string &queryBuffer, Query query, const std::vector< std::string > &tables, const std::chrono::milliseconds ttl )
 {
-	return mysql_insert_id( server );
-}
+	if( !query || !query->resultSet || query->streaming )
+		return;
 
-//Grab a list of tables in the current database.
-std::list< std::string > _Connection::getTableList()
-{		
-	std::list< std::string > Tables;
+	Entry entry;
+	entry.key = makeKey( database, queryBuffer );
+	entry.bytes = resultBytes( *query );
+	entry.expires = std::chrono::steady_clock::now() + (ttl.count() > 0 ? ttl : defaultTtl);
+	entry.tables = tables;
 
-	Query query = sendQuery("SHOW TABLES");
-	if ( !(query) )
-		return (Tables);
+	std::lock_guard< std::mutex > lock( mutex );
+	//A newer result replaces the old one even when it is too large to keep, so the old one is never served again.
+	std::map< std::string, std::list< Entry >::iterator >::iterator found = index.find( entry.key );
+	if( found != index.end() )
+		erase( found->second );
+	if( entry.bytes > maxBytes )
+		return;
 
-	for(unsigned int i = 0;i < query->numRows();++i)
+	//The result is read-only from now on and must outlive the connection it came from.
+	query->server = NULL;
+	query->rowPosition = 0;
+	entry.query = query;
+
+	usedBytes += entry.bytes;
+	entries.push_front( std::move( entry ) );
+	index[ entries.front().key ] = entries.begin();
+
+	while( usedBytes > maxBytes )
 	{
-		Tables.push_back( query->getRow()[ std::string("Tables_in_" + this->databaseName).c_str() ] );
+		erase( std::prev( entries.end() ) );
+		++evictions;
 	}
-	return (Tables);
 }
 
-_Query::_Query()
+void _QueryCache::invalidate( const std::string &table )
 {
-	++numberOfAllocations;
-	resultSet = 0;
-	server = 0;
-}
-
-//Construct and send query automatically.
-_Query::_Query(const std::string &request, _Connection* connection)
-{ 
-	++numberOfAllocations;
-	this->request = request;
-	this->server = connection;
-	this->resultSet = 0;//No result yet.
+	std::lock_guard< std::mutex > lock( mutex );
+	for(std::list< Entry >::iterator entry = entries.begin();entry != entries.end();)
+	{
+		std::list< Entry >::iterator next = std::next( entry );
+		if( std::find( entry->tables.begin(), entry->tables.end(), table ) != entry->tables.end() )
+			erase( entry );
+		entry = next;
+	}
 }
 
-_Query::~_Query()
-{
-	++numberOfDeallocations;
-	clearResultSet();//Just clear the result if one exists.
-}
-int _Query::getNumberOfAllocations()
+void _QueryCache::clear()
 {
-	return numberOfAllocations;
+	std::lock_guard< std::mutex > lock( mutex );
+	entries.clear();
+	index.clear();
+	usedBytes = 0;
 }
-int _Query::getNumberOfDeallocations()
+
+void _QueryCache::setMaxBytes( const size_t maxBytes )
 {
-	return numberOfDeallocations;
+	std::lock_guard< std::mutex > lock( mutex );
+	this->maxBytes = maxBytes;
+	while( usedBytes > maxBytes )
+	{
+		erase( std::prev( entries.end() ) );
+		++evictions;
+	}
 }
-int _Query::getRemainder()
+
+size_t _QueryCache::getUsedBytes()
 {
-	return numberOfAllocations-numberOfDeallocations;
+	std::lock_guard< std::mutex > lock( mutex );
+	return usedBytes;
 }
-
-/************* Query Member Function Implementations ************/
-
-//Set the API sql result
-void _Query::setResultSet( MYSQL_RES* resultSet )
+size_t _QueryCache::size()
 {
-	clearResultSet();
-	this->resultSet = resultSet;
+	std::lock_guard< std::mutex > lock( mutex );
+	return entries.size();
 }
-//Return the API sql result
-MYSQL_RES* _Query::getResultSet()
+unsigned long long _QueryCache::getHits()
 {
-	return resultSet;
+	std::lock_guard< std::mutex > lock( mutex );
+	return hits;
 }
-//Add a row to the 'queue'.
-void _Query::addRow( MYSQL_ROW newRow )
+unsigned long long _QueryCache::getMisses()
 {
-	rows.push_back( newRow );//Add to the end of the 'queue'
+	std::lock_guard< std::mutex > lock( mutex );
+	return misses;
 }
-//Reset the queue iterator to the beginning of the list.
-void _Query::resetRowQueue()
+unsigned long long _QueryCache::getEvictions()
 {
-	rowPosition = rows.begin();
+	std::lock_guard< std::mutex > lock( mutex );
+	return evictions;
 }
-//Reverse the rows in the queue.
-void _Query::reverseRows()
+
+/************* Statement Profiler Member Function Implementations ************/
+
+_StatementProfiler::_StatementProfiler( const std::chrono::microseconds slowThreshold, std::function< void( std::string_view, const QueryTiming & ) > slowQueryLog )
 {
-	rows.reverse();
-	resetRowQueue();
+	this->slowThreshold = slowThreshold;
+	this->slowQueryLog = slowQueryLog;
 }
-//Is there another row in the 'queue'?
-bool _Query::hasNextRow()
+
+static bool isIdentifierCharacter( const char c )
 {
-	return ( rowPosition != rows.end() );
+	return isalnum( (unsigned char)c ) || c == '_' || c == '$';
 }
-//Grab all fields from the sql query result.
-void _Query::setupFields()
+
+//Replace string and number literals with '?' and collapse whitespace. Lists of literals, such as
+//	IN(...) or the rows of a multi-row INSERT, collapse to one entry, so they fingerprint the same
+//	however long they are. This runs in one pass, as it sees every statement.
+std::string _StatementProfiler::fingerprint( std::string_view queryBuffer )
 {
-	if( fields.size() )
-		return;//Fields are already set up.
+	std::string result;
+	result.reserve( queryBuffer.size() < 256 ? queryBuffer.size() : 256 );
 
-	MYSQL_FIELD* mysqlFields = mysql_fetch_fields( getResultSet() ); //This is deleted in mysql_free_result()
-	unsigned int nr_fields = mysql_num_fields( getResultSet() );
+	auto endsWith = [&]( const char *suffix ) {
+		size_t length = strlen( suffix );
+		return result.size() >= length && result.compare( result.size() - length, length, suffix ) == 0;
+	};
+	auto addPlaceholder = [&]() {
+		//"?,?" and "?, ?" become "?".
+		if( endsWith( "?," ) )
+			result.pop_back();
+		else if( endsWith( "?, " ) )
+			result.resize( result.size() - 2 );
+		else
+			result += '?';
+	};
 
-	if( !mysqlFields )
-	{
-		throw FieldException("No fields found");
-	}
-	for(unsigned int i = 0;i < nr_fields;++i)
+	bool pendingSpace = false;
+	size_t i = 0;
+	while( i < queryBuffer.size() )
 	{
-		if(mysqlFields[i].name)
-			fields[ mysqlFields[i].name ]		=	i;
-		else if(mysqlFields[i].org_name)
-			fields[ mysqlFields[i].org_name ]	=	i;
-	}
+		char c = queryBuffer[ i ];
+		if( isspace( (unsigned char)c ) )
+		{
+			pendingSpace = !result.empty();
+			++i;
+			continue;
+		}
+		if( pendingSpace )
+		{
+			result += ' ';
+			pendingSpace = false;
+		}
 
+		if( c == '\'' || c == '"' )
+		{
+			for(++i;i < queryBuffer.size() && queryBuffer[ i ] != c;++i)
+			{
+				if( queryBuffer[ i ] == '\\' )
+					++i;
+			}
+			++i;
+			addPlaceholder();
+		}
+		else if( c == '`' )
+		{
+			size_t end = queryBuffer.find( '`', i + 1 );
+			end = (end == std::string_view::npos) ? queryBuffer.size() : end + 1;
+			result.append( queryBuffer.data() + i, end - i );
+			i = end;
+		}
+		else if( isdigit( (unsigned char)c ) && (i == 0 || !isIdentifierCharacter( queryBuffer[ i - 1 ] )) )
+		{
+			while( i < queryBuffer.size() && (isIdentifierCharacter( queryBuffer[ i ] ) || queryBuffer[ i ] == '.') )
+				++i;
+			addPlaceholder();
+		}
+		else
+		{
+			result += c;
+			++i;
+			//"(?),(?)" and "(?), (?)" become "(?)".
+			if( c == ')' && (endsWith( "(?),(?)" ) || endsWith( "(?), (?)" )) )
+				result.resize( result.size() - (endsWith( "(?),(?)" ) ? 4 : 5) );
+		}
+	}
+	while( !result.empty() && (result.back() == ';' || result.back() == ' ') )
+		result.pop_back();
+	return result;
 }
-//Send the query to the database server.
-Query _Query::send()
-{
-	Query query( this );
-	this->sPtr = std::weak_ptr< _Query >( query );
-
-	if(this->server) server->sendQuery( query );
 
-	//The following only occurs if there was a result from the query.
-	//Non-resulting queries have no data to store.
-	if ( getResultSet() )
+void _StatementProfiler::record( std::string_view queryBuffer, const QueryTiming &timing )
+{
+	std::string key = fingerprint( queryBuffer );
 	{
-		unsigned int nr_rows = (unsigned int)mysql_num_rows( getResultSet() );
-		setupFields();
+		std::lock_guard< std::mutex > lock( mutex );
+		Statistics &entry = statistics[ key ];//Zeroed when first seen.
+		if( entry.count == 0 )
+			entry.fingerprint = key;
+		++entry.count;
+		if( timing.failed )
+			++entry.failures;
+		entry.send += timing.send;
+		entry.execute += timing.execute;
+		entry.fetch += timing.fetch;
+		if( timing.total() > entry.slowest )
+			entry.slowest = timing.total();
+	}
 
-		for(unsigned int i = 0;i < nr_rows;++i)
+	if( slowThreshold.count() > 0 && timing.total() >= slowThreshold )
+	{
+		if( slowQueryLog )
+			slowQueryLog( queryBuffer, timing );
+		else
 		{
-			addRow( mysql_fetch_row( getResultSet() ) );
+			//Batch inserts can be megabytes long, so only the start is logged.
+			std::string_view logged = queryBuffer.substr( 0, 1024 );
+			std::cout << "Slow query( " << timing.total().count() << "us: send " << timing.send.count() << "us, execute "
+				<< timing.execute.count() << "us, fetch " << timing.fetch.count() << "us ) : " << logged
+				<< (logged.size() < queryBuffer.size() ? "..." : "") << std::endl;
 		}
 	}
-	rowPosition = rows.begin();
-	return query;
 }
-//Clear out the result data & all corresponding data.
-void _Query::clearResultSet()
+
+std::vector< _StatementProfiler::Statistics > _StatementProfiler::getStatistics()
 {
-	if(this->resultSet)//If no result, then there is nothing being stored!
+	std::vector< Statistics > result;
 	{
-		mysql_free_result( resultSet );//Free API sql result
-		resultSet = 0;	
-
-		rows.clear();//Clear rows
-		fields.clear();//Clear field names & indexes
+		std::lock_guard< std::mutex > lock( mutex );
+		result.reserve( statistics.size() );
+		for(std::map< std::string, Statistics >::iterator entry = statistics.begin();entry != statistics.end();++entry)
+			result.push_back( entry->second );
 	}
+	std::sort( result.begin(), result.end(), []( const Statistics &a, const Statistics &b ) { return a.total() > b.total(); } );
+	return result;
 }
 
-//Number of data entries(rows) returned by the sql query.
-unsigned int _Query::numRows()
+void _StatementProfiler::reset()
 {
-	return (unsigned int)rows.size();
+	std::lock_guard< std::mutex > lock( mutex );
+	statistics.clear();
 }
-//Number of fields returned by the sql query
-unsigned int _Query::numFields()
+
+/************* Connection Pool Member Function Implementations ************/
+
+PooledConnection::PooledConnection( ConnectionPool pool, Connection connection )
 {
-	return (unsigned int)fields.size();
+	this->pool = pool;
+	this->connection = connection;
 }
-//Grab the numerical index for a field.
-int _Query::getIndexByField( const std::string &field )
+PooledConnection::PooledConnection( PooledConnection &&other )
 {
-	return fields[ field ];
+	pool = std::move( other.pool );
+	connection = std::move( other.connection );
 }
-std::string _Query::getFieldByIndex( const int index )
+PooledConnection &PooledConnection::operator=( PooledConnection &&other )
 {
-	for(sqlFieldSet::iterator fieldIterator = fields.begin();fieldIterator != fields.end();++fieldIterator)
+	if( this != &other )
 	{
-		if( (*fieldIterator).second == index )
-			return (*fieldIterator).first;
+		release();
+		pool = std::move( other.pool );
+		connection = std::move( other.connection );
 	}
-	return std::string("");
+	return *this;
 }
-//A bit redundant, but more efficient than grabbing a row iterate when un-needed.
-void _Query::skipRow()
+PooledConnection::~PooledConnection()
 {
-	if( rowPosition != rows.end() ) ++rowPosition;//Iterate only if not at the end of the list.
+	release();
 }
-//Grab the next row in the 'queue' and move on to the next.
-Row _Query::getRow()
+void PooledConnection::release()
 {
-	Row Data;//Data stored & returned from here.
-
-	if( !server )
-		throw QueryException("There is no MySQL server connection for this query object.");
-	if( !resultSet )
-		throw QueryException("There is no MySQL query result stored.");
-	if( rowPosition == rows.end() )//We're at the end of the queue. Must be reset.
-		throw QueryException("The cursor is at the end of the row queue.");
-
-	Data = Row(this->sPtr, *(rowPosition++));//Grab this row & iterate
-	return Data;
+	if( pool && connection )
+		pool->checkin( connection );
+	connection.reset();
+	pool.reset();
 }
-//Grab the next row in the 'queue' without iterating.
-Row _Query::peekRow()
-{
-	Row row;//Data stored & returned from here.
-
-	if( !server )
-		throw QueryException("There is no MySQL server connection for this query object.");
-	if( !resultSet )
-		throw QueryException("There is no MySQL query result stored.");
-	if( rowPosition == rows.end() )//We're at the end of the queue. Must be reset.
-		throw QueryException("The cursor is at the end of the row queue.");
 
-	row = Row( this->sPtr, *(rowPosition) );//Grab this row
-	return row;
-}
-void BatchInsertStatement::init( Connection connection, const std::string &tableName, const unsigned int insertsPerFlush, bool insertIgnore )
+_ConnectionPool::_ConnectionPool( Context context, const unsigned int minSize, const unsigned int maxSize )
 {
-	this->connection = connection;
-	this->tableName = tableName;
-	this->numberOfInserts = 0;
-	this->numberOfFieldsLoaded = 0;
-	this->insertsPerFlush = insertsPerFlush;
-	this->firstFieldThisEntry = false;
-	this->hasStarted = false;
+	//The client library must be initialized once before connections are opened from several threads.
+	static std::once_flag libraryInitialized;
+	std::call_once( libraryInitialized, [](){ mysql_library_init(0, NULL, NULL); } );
 
-	sql << "INSERT" << (insertIgnore ? " IGNORE" : "") << " INTO ";
-	sql << tableName;
-	sql << "(";
+	if( maxSize == 0 || minSize > maxSize )
+		throw ConnectionException("A connection pool needs a maximum size of at least one, and no smaller than its minimum size.");
 
-	this->firstField = true;
+	this->context = context;
+	this->minSize = minSize;
+	this->maxSize = maxSize;
+	this->openConnections = 0;
+	this->idleTimeout = std::chrono::minutes(5);
+	this->waitTimeout = std::chrono::seconds(30);
+	this->healthCheckInterval = std::chrono::seconds(30);
+
+	for(unsigned int i = 0;i < minSize;++i)
+	{
+		idle.push_back( { context->createConnection(), std::chrono::steady_clock::now() } );
+		++openConnections;
+	}
 }
-BatchInsertStatement::BatchInsertStatement()
+
+Connection _ConnectionPool::openConnection()
 {
-	init( Connection(reinterpret_cast<_Connection*>(NULL)), "", 1000, false );
+	Context owner = context.lock();
+	if( !owner )
+		throw ConnectionException("The context that created this connection pool no longer exists.");
+	return owner->createConnection();
 }
-BatchInsertStatement::BatchInsertStatement( _Connection *connection, const std::string &tableName, const unsigned int insertsPerFlush )
+
+PooledConnection _ConnectionPool::checkout()
 {
-	init( Connection(connection), tableName, insertsPerFlush, false );
+	std::vector< Connection > expired;
+	std::unique_lock< std::mutex > lock( mutex );
+	auto deadline = std::chrono::steady_clock::now() + waitTimeout;
+
+	while( true )
+	{
+		collectExpired( expired );
+		if( !idle.empty() )
+		{
+			IdleConnection candidate = idle.back();
+			idle.pop_back();
+			bool needsCheck = (std::chrono::steady_clock::now() - candidate.returned) >= healthCheckInterval;
+
+			lock.unlock();
+			expired.clear();
+			if( !needsCheck || candidate.connection->isConnected() )
+				return PooledConnection( shared_from_this(), candidate.connection );
+
+			//The server dropped this one. Close it and look again.
+			candidate.connection.reset();
+			lock.lock();
+			--openConnections;
+			continue;
+		}
+		if( openConnections < maxSize )
+		{
+			++openConnections;
+			lock.unlock();
+			expired.clear();
+			try {
+				return PooledConnection( shared_from_this(), openConnection() );
+			} catch( ... ) {
+				//Whatever went wrong, the slot reserved above has to be given back.
+				lock.lock();
+				--openConnections;
+				connectionReturned.notify_one();
+				throw;
+			}
+		}
+		if( connectionReturned.wait_until( lock, deadline ) == std::cv_status::timeout && idle.empty() && openConnections >= maxSize )
+		{
+			std::stringstream errorMessage;
+			errorMessage << "Timed out waiting for one of " << maxSize << " pooled connections to be returned.";
+			throw ConnectionException( errorMessage.str() );
+		}
+	}
 }
-BatchInsertStatement::BatchInsertStatement( Connection connection, const std::string &tableName, const unsigned int insertsPerFlush )
+
+void _ConnectionPool::checkin( Connection connection )
 {
-	init( connection, tableName, insertsPerFlush, false );
+	std::vector< Connection > expired;
+	{
+		std::lock_guard< std::mutex > lock( mutex );
+		//A connection still reserved by a stream cannot be handed to anyone else.
+		if( connection->hasOpenStream() )
+		{
+			expired.push_back( connection );
+			--openConnections;
+		}
+		else
+			idle.push_back( { connection, std::chrono::steady_clock::now() } );
+		collectExpired( expired );
+	}
+	connectionReturned.notify_one();
+	//Expired connections are closed here, outside of the lock.
 }
 
-BatchInsertStatement::BatchInsertStatement( Connection connection, const std::string &tableName, const unsigned int insertsPerFlush, bool insertIgnore )
+//Move connections idle for longer than the timeout out of the pool, oldest first. Requires the lock.
+void _ConnectionPool::collectExpired( std::vector< Connection > &expired )
 {
-	init( connection, tableName, insertsPerFlush, insertIgnore );
+	auto now = std::chrono::steady_clock::now();
+	size_t nr_expired = 0;
+	while( nr_expired < idle.size() && openConnections > minSize && (now - idle[ nr_expired ].returned) >= idleTimeout )
+	{
+		expired.push_back( idle[ nr_expired ].connection );
+		--openConnections;
+		++nr_expired;
+	}
+	idle.erase( idle.begin(), idle.begin() + nr_expired );
 }
 
-BatchInsertStatement::BatchInsertStatement( _Connection *connection, const std::string &tableName, const unsigned int insertsPerFlush, bool insertIgnore )
+void _ConnectionPool::evictIdleConnections()
 {
-	init( Connection(connection), tableName, insertsPerFlush, insertIgnore );
+	std::vector< Connection > expired;
+	std::lock_guard< std::mutex > lock( mutex );
+	collectExpired( expired );
 }
 
-void BatchInsertStatement::start()
+void _ConnectionPool::setIdleTimeout( const std::chrono::milliseconds timeout )
 {
-	sql << ")VALUES";
-	header = sql.str();
-	hasStarted = true;
+	std::lock_guard< std::mutex > lock( mutex );
+	idleTimeout = timeout;
 }
-void BatchInsertStatement::flush()
+void _ConnectionPool::setWaitTimeout( const std::chrono::milliseconds timeout )
 {
-	if( numberOfInserts > 0 ) {
-		connection->sendRawQuery( sql.str() );
+	std::lock_guard< std::mutex > lock( mutex );
+	waitTimeout = timeout;
+}
+void _ConnectionPool::setHealthCheckInterval( const std::chrono::milliseconds interval )
+{
+	std::lock_guard< std::mutex > lock( mutex );
+	healthCheckInterval = interval;
+}
+unsigned int _ConnectionPool::getOpenConnections()
+{
+	std::lock_guard< std::mutex > lock( mutex );
+	return openConnections;
+}
+unsigned int _ConnectionPool::getIdleConnections()
+{
+	std::lock_guard< std::mutex > lock( mutex );
+	return (unsigned int)idle.size();
+}
+
+_Connection::_Connection()
+{
+	activeStream = NULL;
+	activeAsyncQuery = NULL;
+	localInfile = false;
+	autoReconnect = false;
+	reconnectPending = false;
+	reconnectAttempts = 5;
+	initialBackoff = std::chrono::milliseconds(100);
+	maxBackoff = std::chrono::milliseconds(5000);
+	resetMetrics();
+	openServer();
+}
+
+_Connection::_Connection( const std::string &host, const std::string &user, const std::string &password, const std::string &name )
+	: _Connection()
+{
+	connect( host, user, password, name );
+}
+_Connection::_Connection( const std::string &host, const std::string &user, const std::string &password, const std::string &name, const ConnectionOptions &options )
+	: _Connection()
+{
+	setOptions( options );
+	connect( host, user, password, name );
+}
+
+//Make the client library's handle, before connecting.
+void _Connection::openServer()
+{
+	server = mysql_init( 0 );
+#ifdef SQL_DATABASE_ASYNC
+	//Blocking calls work as before. This only allows the non-blocking ones as well.
+	mysql_options( server, MYSQL_OPT_NONBLOCK, 0 );
+#endif
+}
+_Connection::~_Connection()
+{
+	//An open stream or pending query can no longer read from this connection.
+	if( activeStream ) activeStream->server = NULL;
+#ifdef SQL_DATABASE_ASYNC
+	if( activeAsyncQuery )
+	{
+		_AsyncQuery *pending = activeAsyncQuery;
+		activeAsyncQuery = NULL;
+		pending->server = NULL;
+		pending->fail( "The connection was closed before the query completed." );
+	}
+#endif
+	if ( server ) mysql_close( server );
+}
+
+//Hand the connection options to a fresh handle, before mysql_real_connect().
+void _Connection::applyOptions()
+{
+	unsigned int seconds;
+	if( options.connectTimeout.count() > 0 )
+	{
+		seconds = (unsigned int)options.connectTimeout.count();
+		mysql_options( server, MYSQL_OPT_CONNECT_TIMEOUT, &seconds );
+	}
+	if( options.readTimeout.count() > 0 )
+	{
+		seconds = (unsigned int)options.readTimeout.count();
+		mysql_options( server, MYSQL_OPT_READ_TIMEOUT, &seconds );
+	}
+	if( options.writeTimeout.count() > 0 )
+	{
+		seconds = (unsigned int)options.writeTimeout.count();
+		mysql_options( server, MYSQL_OPT_WRITE_TIMEOUT, &seconds );
+	}
+
+	if( options.compression != ConnectionOptions::NoCompression )
+	{
+#ifdef SQL_DATABASE_ZSTD
+		//zlib stays on the list for servers built without zstd, or older than 8.0.18.
+		bool zstd = options.compression == ConnectionOptions::Zstd;
+		mysql_options( server, MYSQL_OPT_COMPRESSION_ALGORITHMS, zstd ? "zstd,zlib" : "zlib" );
+		if( zstd && options.zstdLevel )
+			mysql_options( server, MYSQL_OPT_ZSTD_COMPRESSION_LEVEL, &options.zstdLevel );
+#else
+		mysql_options( server, MYSQL_OPT_COMPRESS, 0 );
+#endif
+	}
+
+	if( !options.characterSet.empty() )
+		mysql_options( server, MYSQL_SET_CHARSET_NAME, options.characterSet.c_str() );
+	for(const std::string &command : options.initCommands)
+		mysql_options( server, MYSQL_INIT_COMMAND, command.c_str() );
+
+	if( !options.sslKey.empty() ) mysql_options( server, MYSQL_OPT_SSL_KEY, options.sslKey.c_str() );
+	if( !options.sslCert.empty() ) mysql_options( server, MYSQL_OPT_SSL_CERT, options.sslCert.c_str() );
+	if( !options.sslCa.empty() ) mysql_options( server, MYSQL_OPT_SSL_CA, options.sslCa.c_str() );
+	if( !options.sslCaPath.empty() ) mysql_options( server, MYSQL_OPT_SSL_CAPATH, options.sslCaPath.c_str() );
+	if( !options.sslCipher.empty() ) mysql_options( server, MYSQL_OPT_SSL_CIPHER, options.sslCipher.c_str() );
+
+	if( options.sslMode != ConnectionOptions::SslPreferred )
+	{
+#ifdef SQL_DATABASE_MARIADB
+		my_bool enabled = 1;
+		mysql_options( server, MYSQL_OPT_SSL_ENFORCE, &enabled );
+		if( options.sslMode == ConnectionOptions::SslVerifyIdentity )
+			mysql_options( server, MYSQL_OPT_SSL_VERIFY_SERVER_CERT, &enabled );
+#else
+		unsigned int mode = options.sslMode == ConnectionOptions::SslVerifyIdentity ? SSL_MODE_VERIFY_IDENTITY : SSL_MODE_REQUIRED;
+		mysql_options( server, MYSQL_OPT_SSL_MODE, &mode );
+#endif
+	}
+}
+
+void _Connection::connect( const std::string &host, const std::string &user, const std::string &password, const std::string &name )
+{
+	this->host = host;
+	this->user = user;
+	this->password = password;
+	this->databaseName = name;
+
+	//The handler is installed even when local infile is off, so that the client library's own
+	//	handler, which reads whatever file the server names, is never used.
+	unsigned int allowLocalInfile = localInfile ? 1 : 0;
+	mysql_options( server, MYSQL_OPT_LOCAL_INFILE, &allowLocalInfile );
+	mysql_set_local_infile_handler( server, localInfileInit, localInfileRead, localInfileEnd, localInfileError, this );
+	applyOptions();
+
+	const char *unixSocket = options.unixSocket.empty() ? NULL : options.unixSocket.c_str();
+	if(!mysql_real_connect(server, host.c_str(), user.c_str(), password.c_str(), name.c_str(),
+	options.port, unixSocket, CLIENT_MULTI_STATEMENTS | options.clientFlags | (localInfile ? CLIENT_LOCAL_FILES : 0)))
+	{
+		std::stringstream errorMessage;
+		errorMessage << "Failed to connect to database '" << name << "' as '" << user << "' @" << host << ": " << mysql_error( server );
+		throw ConnectionException( errorMessage.str() );
+	}
+}
+
+void _Connection::reconnect()
+{
+	checkAvailable();
+	if( server )
+		mysql_close( server );
+	openServer();
+	reconnectPending = false;
+	connect( host, user, password, databaseName );
+}
+
+void _Connection::setAutoReconnect( const bool enabled, const unsigned int maxAttempts, const std::chrono::milliseconds initialBackoff, const std::chrono::milliseconds maxBackoff )
+{
+	this->autoReconnect = enabled;
+	this->reconnectAttempts = maxAttempts ? maxAttempts : 1;
+	this->initialBackoff = initialBackoff;
+	this->maxBackoff = maxBackoff;
+}
+
+//Try to reconnect until it works or the attempts run out, waiting longer after each failure.
+void _Connection::reconnectWithBackoff()
+{
+	std::chrono::milliseconds backoff = initialBackoff;
+	for(unsigned int attempt = 1;;++attempt)
+	{
+		try {
+			reconnect();
+			return;
+		} catch( ConnectionException &e ) {
+			reconnectPending = true;
+			if( attempt >= reconnectAttempts )
+				throw;
+		}
+		std::this_thread::sleep_for( backoff );
+		backoff = std::min( backoff * 2, maxBackoff );
+	}
+}
+
+//Whether a statement can safely be sent again after the connection dropped under it, which is
+//	only true of a single read.
+bool _Connection::isIdempotent( const char *query, const size_t length )
+{
+	size_t i = 0;
+	while( i < length )
+	{
+		if( isspace( (unsigned char)query[ i ] ) || query[ i ] == '(' )
+			++i;
+		else if( query[ i ] == '/' && i + 1 < length && query[ i + 1 ] == '*' )
+		{
+			//The buffer need not end in a NUL, so the search stays within its length.
+			size_t end = std::string_view( query, length ).find( "*/", i + 2 );
+			if( end == std::string_view::npos )
+				return false;
+			i = end + 2;
+		}
+		else
+			break;
+	}
+
+	//Several statements may mix reads with writes.
+	for(size_t j = i;j < length;++j)
+	{
+		if( query[ j ] == ';' )
+		{
+			for(++j;j < length;++j)
+				if( !isspace( (unsigned char)query[ j ] ) && query[ j ] != ';' )
+					return false;
+		}
+	}
+
+	size_t end = i;
+	while( end < length && isalpha( (unsigned char)query[ end ] ) )
+		++end;
+	std::string keyword( query + i, end - i );
+	for(size_t j = 0;j < keyword.size();++j)
+		keyword[ j ] = (char)toupper( (unsigned char)keyword[ j ] );
+
+	if( keyword == "SELECT" )
+	{
+		//A locking read belongs to the transaction it was meant for.
+		std::string rest( query + end, length - end );
+		for(size_t j = 0;j < rest.size();++j)
+			rest[ j ] = (char)toupper( (unsigned char)rest[ j ] );
+		return rest.find( "FOR UPDATE" ) == std::string::npos && rest.find( "LOCK IN SHARE MODE" ) == std::string::npos
+			&& rest.find( " INTO " ) == std::string::npos;
+	}
+	return keyword == "SHOW" || keyword == "DESC" || keyword == "DESCRIBE" || keyword == "EXPLAIN";
+}
+
+void _Connection::reportError()
+{
+	std::cout << "SQL Error : " << mysql_error( server ) << std::endl;
+}
+
+void _Connection::reportError( const std::string &logMessage )
+{
+	std::cout << "SQL Error( " << mysql_error( server ) << " ) : " << logMessage << std::endl;
+}
+
+bool _Connection::isConnected()
+{
+	//Pinging while a stream or query is in progress would put the connection out of sync.
+	if( activeStream || activeAsyncQuery )
+		return true;
+	return (server && mysql_ping(server) == 0);
+}
+
+//Throw if the connection is busy with a stream and cannot accept another query.
+void _Connection::checkAvailable()
+{
+	if( activeStream )
+	{
+		throw QueryException("A streaming query is still open on this connection. Read all of its rows or close it before sending another query.",
+			NULL, activeStream->getQueryBuffer().c_str());
+	}
+	if( activeAsyncQuery )
+		throw QueryException("A non-blocking query is still in progress on this connection.");
+}
+
+void _Connection::releaseStream( _Query *query )
+{
+	if( activeStream == query )
+	{
+		activeStream = NULL;
+		if( !discardPendingResults() )
+			reportError( "A statement sent after a streaming query failed." );
+	}
+}
+
+//Read and free the results of any statements still pending after the first, so the connection
+//	is ready for the next query. Returns false if one of those statements failed.
+bool _Connection::discardPendingResults()
+{
+	if( !server )
+		return true;
+	int status;
+	while( (status = mysql_next_result( server )) == 0 )
+	{
+		MYSQL_RES *result = mysql_store_result( server );
+		if( result )
+			mysql_free_result( result );
+	}
+	return status < 0;
+}
+
+Query _Connection::sendQuery( std::string queryBuffer )
+{
+	//The query and its reference count share one allocation.
+	Query query = std::make_shared< _Query >( std::move( queryBuffer ), this );
+	return query->send();
+}
+Query _Connection::streamQuery( std::string queryBuffer )
+{
+	Query query = std::make_shared< _Query >( std::move( queryBuffer ), this );
+	query->streaming = true;
+
+	return query->send();
+}
+//Time since the mark, moving the mark up to now.
+static std::chrono::microseconds lap( std::chrono::steady_clock::time_point &mark )
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	std::chrono::microseconds elapsed = std::chrono::duration_cast< std::chrono::microseconds >( now - mark );
+	mark = now;
+	return elapsed;
+}
+
+//The same as mysql_real_query(), in two steps so that sending and executing are timed apart.
+//	A dropped connection is reopened here when auto reconnect is enabled.
+int _Connection::runQuery( const char *query, const size_t length, QueryTiming &timing )
+{
+	if( reconnectPending && autoReconnect )
+		reconnectWithBackoff();
+
+	for(int attempt = 0;;++attempt)
+	{
+		const bool inTransaction = (server->server_status & SERVER_STATUS_IN_TRANS) != 0;
+		std::chrono::steady_clock::time_point mark = std::chrono::steady_clock::now();
+		int retval = mysql_send_query( server, query, (unsigned long)length );
+		timing.send += lap( mark );
+		if( retval == 0 )
+		{
+			retval = mysql_read_query_result( server ) != 0 ? 1 : 0;
+			timing.execute += lap( mark );
+		}
+		timing.failed = retval != 0;
+
+		if( retval == 0 || !autoReconnect || inTransaction )
+			return retval;
+		unsigned int error = mysql_errno( server );
+		if( error != CR_SERVER_GONE_ERROR && error != CR_SERVER_LOST )
+			return retval;
+
+		if( attempt > 0 || !isIdempotent( query, length ) )
+		{
+			//Leave the error for the caller to report, and reopen the connection before the next statement.
+			reconnectPending = true;
+			return retval;
+		}
+		reconnectWithBackoff();
+	}
+}
+
+void _Connection::sendQuery( Query query )
+{
+	int retval;
+	checkAvailable();
+	const std::string &queryBuffer = query->request;
+	QueryTiming timing;
+	//Nonzero return value means there was an error.
+	if( (retval = runQuery( queryBuffer.data(), queryBuffer.size(), timing )) != 0 )
+	{
+		recordQuery( queryBuffer.data(), queryBuffer.size(), timing );
+		std::stringstream errorMessage;
+		errorMessage << "Failed to send query. Errno: " << retval;
+		throw QueryException(errorMessage.str(),this->server, queryBuffer.c_str());
+	}
+	std::chrono::steady_clock::time_point mark = std::chrono::steady_clock::now();
+	//There is no error reporting, because many queries do not store a result.
+	if( query->isStreaming() )
+	{
+		query->setResultSet( mysql_use_result( server ) );
+		if( query->getResultSet() )
+			activeStream = query.get();
+	}
+	else
+	{
+		query->setResultSet( mysql_store_result( server ) );
+		if( !discardPendingResults() )
+		{
+			timing.fetch = lap( mark );
+			timing.failed = true;
+			recordQuery( queryBuffer.data(), queryBuffer.size(), timing );
+			throw QueryException("A later statement in the query failed.", this->server, queryBuffer.c_str());
+		}
+	}
+	timing.fetch = lap( mark );
+	recordQuery( queryBuffer.data(), queryBuffer.size(), timing );
+}
+
+//The length of a statement without any trailing ';' and whitespace. Statements that are joined
+//	into one multi-statement packet are cut to this, as a trailing ';' would make an extra,
+//	empty statement that the server rejects.
+static size_t statementLength( const std::string &statement )
+{
+	size_t length = statement.size();
+	while( length > 0 && (statement[ length - 1 ] == ';' || isspace( (unsigned char)statement[ length - 1 ] )) )
+		--length;
+	return length;
+}
+
+std::vector< Query > _Connection::sendQueries( const std::vector< std::string > &queryBuffers )
+{
+	std::vector< Query > queries;
+	if( queryBuffers.empty() )
+		return queries;
+	checkAvailable();
+
+	std::string packet;
+	for(size_t i = 0;i < queryBuffers.size();++i)
+	{
+		size_t length = statementLength( queryBuffers[ i ] );
+		if( length == 0 )
+			throw QueryException("Every statement sent by sendQueries() must be non-empty.", NULL, queryBuffers[ i ].c_str());
+		if( i > 0 )
+			packet += ';';
+		packet.append( queryBuffers[ i ], 0, length );
+	}
+
+	int retval;
+	QueryTiming timing;
+	//Nonzero return value means the first statement failed.
+	if( (retval = runQuery( packet.data(), packet.size(), timing )) != 0 )
+	{
+		recordQuery( packet.data(), packet.size(), timing );
+		std::stringstream errorMessage;
+		errorMessage << "Failed to send query. Errno: " << retval;
+		throw QueryException(errorMessage.str(), this->server, queryBuffers[ 0 ].c_str());
+	}
+
+	std::chrono::steady_clock::time_point mark = std::chrono::steady_clock::now();
+	queries.reserve( queryBuffers.size() );
+	while( true )
+	{
+		//A statement such as CALL can return more results than were asked for. Those are discarded.
+		MYSQL_RES *result = mysql_store_result( server );
+		if( queries.size() < queryBuffers.size() )
+		{
+			Query query = std::make_shared< _Query >( queryBuffers[ queries.size() ], this );
+			query->setResultSet( result );
+			query->loadResult();
+			queries.push_back( query );
+		}
+		else if( result )
+			mysql_free_result( result );
+
+		int status = mysql_next_result( server );
+		if( status == -1 )
+			break;
+		if( status > 0 )
+		{
+			timing.fetch = lap( mark );
+			timing.failed = true;
+			recordQuery( packet.data(), packet.size(), timing );
+			std::stringstream errorMessage;
+			errorMessage << "Failed on statement " << (queries.size() + 1) << " of " << queryBuffers.size() << ".";
+			const char *failed = queries.size() < queryBuffers.size() ? queryBuffers[ queries.size() ].c_str() : packet.c_str();
+			throw QueryException(errorMessage.str(), this->server, failed);
+		}
+	}
+	timing.fetch = lap( mark );
+	recordQuery( packet.data(), packet.size(), timing );
+	return queries;
+}
+
+ConstQuery _Connection::sendCachedQuery( const std::string &queryBuffer, const std::vector< std::string > &tables, const std::chrono::milliseconds ttl )
+{
+	if( !queryCache )
+		return sendQuery( queryBuffer );
+
+	ConstQuery cached = queryCache->find( this->databaseName, queryBuffer );
+	if( cached )
+		return cached;
+
+	Query query = sendQuery( queryBuffer );
+	queryCache->insert( this->databaseName, queryBuffer, query, tables, ttl );
+	return query;
+}
+
+//This method will simply send the query without storing a result, or an Query object.
+void _Connection::sendRawQuery( const std::string &query )
+{
+	sendRawQuery( query.data(), query.size() );
+}
+void _Connection::sendRawQuery( const char *query, const size_t length )
+{
+	int retval;
+	checkAvailable();
+	QueryTiming timing;
+	//Nonzero return value means there was an error.
+	if( (retval = runQuery( query, length, timing )) != 0 )
+	{
+		recordQuery( query, length, timing );
+		std::stringstream errorMessage;
+		errorMessage << "Failed to send query. Errno: " << retval;
+		throw QueryException(errorMessage.str(), this->server, std::string(query, length).c_str());
+	}
+	//Nothing is kept, but every result must still be read before the connection can be used again.
+	std::chrono::steady_clock::time_point mark = std::chrono::steady_clock::now();
+	MYSQL_RES *result = mysql_store_result( server );
+	if( result )
+		mysql_free_result( result );
+	if( !discardPendingResults() )
+	{
+		timing.fetch = lap( mark );
+		timing.failed = true;
+		recordQuery( query, length, timing );
+		throw QueryException("A later statement in the query failed.", this->server, std::string(query, length).c_str());
+	}
+	timing.fetch = lap( mark );
+	recordQuery( query, length, timing );
+}
+
+//Run a LOAD DATA LOCAL INFILE statement, serving data whenever the server asks for the file.
+my_ulonglong _Connection::loadLocalInfile( const std::string &statement, std::string_view data, unsigned int &warnings )
+{
+	checkAvailable();
+	if( !localInfile )
+		throw QueryException("LOAD DATA LOCAL INFILE is not allowed on this connection. See setLocalInfile().", NULL, statement.c_str());
+
+	QueryTiming timing;
+	localInfileData = data;
+	int retval = runQuery( statement.data(), statement.size(), timing );
+	const size_t bytesRead = data.size() - localInfileData.size();
+	localInfileData = std::string_view();
+	recordQuery( statement.data(), statement.size(), timing );
+	metrics.bytesSent.fetch_add( bytesRead, std::memory_order_relaxed );
+	if( retval != 0 )
+	{
+		std::stringstream errorMessage;
+		errorMessage << "Failed to load data. Errno: " << retval;
+		throw QueryException(errorMessage.str(), this->server, statement.c_str());
+	}
+	warnings = mysql_warning_count( server );
+	return mysql_affected_rows( server );
+}
+
+int _Connection::localInfileInit( void **state, const char *fileName, void *connection )
+{
+	//The state is the connection while data is being served, and NULL to refuse the request.
+	_Connection *self = (_Connection*)connection;
+	*state = ( self->localInfileData.data() && !strcmp( fileName, BulkLoader::fileName ) ) ? self : NULL;
+	return *state ? 0 : 1;
+}
+int _Connection::localInfileRead( void *state, char *buffer, unsigned int length )
+{
+	_Connection *self = (_Connection*)state;
+	size_t count = std::min( (size_t)length, self->localInfileData.size() );
+	memcpy( buffer, self->localInfileData.data(), count );
+	self->localInfileData.remove_prefix( count );
+	return (int)count;
+}
+void _Connection::localInfileEnd( void *state )
+{
+}
+int _Connection::localInfileError( void *state, char *message, unsigned int length )
+{
+	snprintf( message, length, "Only a running sqlDatabase BulkLoader can send data for LOAD DATA LOCAL INFILE." );
+	return CR_UNKNOWN_ERROR;
+}
+
+const char *_Connection::getCharacterSet()
+{
+	return mysql_character_set_name( server );
+}
+
+void _Connection::recordQuery( const char *query, const size_t length, const QueryTiming &timing )
+{
+	unsigned long long microseconds = (unsigned long long)timing.total().count();
+	int bucket = 0;
+	while( bucket < ConnectionMetrics::latencyBuckets - 1 && (microseconds >> bucket) != 0 )
+		++bucket;
+
+	metrics.queries.fetch_add( 1, std::memory_order_relaxed );
+	if( timing.failed )
+		metrics.failedQueries.fetch_add( 1, std::memory_order_relaxed );
+	metrics.bytesSent.fetch_add( length, std::memory_order_relaxed );
+	metrics.totalLatencyMicroseconds.fetch_add( microseconds, std::memory_order_relaxed );
+	metrics.latencyHistogram[ bucket ].fetch_add( 1, std::memory_order_relaxed );
+
+	if( queryProfiler )
+		queryProfiler->record( std::string_view( query, length ), timing );
+}
+
+void _Connection::recordRows( const size_t rows, const size_t bytes )
+{
+	metrics.rowsFetched.fetch_add( rows, std::memory_order_relaxed );
+	metrics.bytesReceived.fetch_add( bytes, std::memory_order_relaxed );
+}
+
+ConnectionMetrics _Connection::getMetrics() const
+{
+	ConnectionMetrics snapshot;
+	snapshot.queries = metrics.queries.load( std::memory_order_relaxed );
+	snapshot.failedQueries = metrics.failedQueries.load( std::memory_order_relaxed );
+	snapshot.bytesSent = metrics.bytesSent.load( std::memory_order_relaxed );
+	snapshot.bytesReceived = metrics.bytesReceived.load( std::memory_order_relaxed );
+	snapshot.rowsFetched = metrics.rowsFetched.load( std::memory_order_relaxed );
+	snapshot.totalLatencyMicroseconds = metrics.totalLatencyMicroseconds.load( std::memory_order_relaxed );
+	for(int i = 0;i < ConnectionMetrics::latencyBuckets;++i)
+		snapshot.latencyHistogram[ i ] = metrics.latencyHistogram[ i ].load( std::memory_order_relaxed );
+	return snapshot;
+}
+
+void _Connection::resetMetrics()
+{
+	metrics.queries.store( 0 );
+	metrics.failedQueries.store( 0 );
+	metrics.bytesSent.store( 0 );
+	metrics.bytesReceived.store( 0 );
+	metrics.rowsFetched.store( 0 );
+	metrics.totalLatencyMicroseconds.store( 0 );
+	for(int i = 0;i < ConnectionMetrics::latencyBuckets;++i)
+		metrics.latencyHistogram[ i ].store( 0 );
+}
+
+unsigned long long ConnectionMetrics::getLatencyPercentile( const double fraction ) const
+{
+	unsigned long long total = 0;
+	for(int i = 0;i < latencyBuckets;++i)
+		total += latencyHistogram[ i ];
+	if( total == 0 )
+		return 0;
+
+	unsigned long long target = (unsigned long long)(fraction * (double)total);
+	unsigned long long seen = 0;
+	for(int i = 0;i < latencyBuckets;++i)
+	{
+		seen += latencyHistogram[ i ];
+		if( seen > target || i == latencyBuckets - 1 )
+			return 1ULL << i;
+	}
+	return 0;
+}
+my_ulonglong _Connection::lastInsertID()
+{
+	return mysql_insert_id( server );
+}
+
+//Grab a list of tables in the current database.
+std::list< std::string > _Connection::getTableList()
+{		
+	std::list< std::string > Tables;
+
+	Query query = sendQuery("SHOW TABLES");
+	if ( !(query) )
+		return (Tables);
+
+	for(unsigned int i = 0;i < query->numRows();++i)
+	{
+		Tables.push_back( query->getRow()[ std::string("Tables_in_" + this->databaseName).c_str() ] );
+	}
+	return (Tables);
+}
+
+std::optional< time_t > _Connection::getTableUpdateTime( const std::string &table )
+{
+	Query query = sendQuery( "SELECT UNIX_TIMESTAMP(UPDATE_TIME) FROM information_schema.TABLES WHERE TABLE_SCHEMA=DATABASE() AND TABLE_NAME=" + escapeQuoteString( table ) );
+	if( !query || !query->hasNextRow() )
+		return std::optional< time_t >();
+	std::optional< long long > updated = query->getRow().getNullableLongLong( 0 );
+	return updated ? std::optional< time_t >( (time_t)*updated ) : std::optional< time_t >();
+}
+
+MaterializedResult _Connection::sendSnapshotQuery( const std::string &queryBuffer, const std::string &path, const std::string &version )
+{
+	try {
+		MaterializedResult snapshot = _MaterializedResult::open( path );
+		if( snapshot->getVersion() == version && snapshot->getQueryBuffer() == queryBuffer )
+			return snapshot;
+	} catch( QueryException &e ) {
+		//Missing or damaged, so it is replaced below.
+	}
+
+	MaterializedResult result = sendQuery( queryBuffer )->materialize();
+	try {
+		result->save( path, version );
+	} catch( QueryException &e ) {
+		e.report();
+	}
+	return result;
+}
+
+//Escape using the connection's character set, which matters for multi-byte sets such as GBK or SJIS.
+void _Connection::appendEscapedString( std::string &buffer, const char *str, const size_t length )
+{
+	size_t start = buffer.size();
+	buffer.resize( start + length * 2 + 1 );
+	unsigned long written = mysql_real_escape_string( server, &buffer[ start ], str, (unsigned long)length );
+	if( written == (unsigned long)-1 )
+	{
+		buffer.resize( start );
+		throw QueryException("Failed to escape string for the connection's character set.", server);
+	}
+	buffer.resize( start + written );
+}
+std::string _Connection::escapeString( const std::string &str )
+{
+	std::string escapedString;
+	appendEscapedString( escapedString, str.data(), str.size() );
+	return escapedString;
+}
+std::string _Connection::escapeQuoteString( const std::string &str )
+{
+	std::string quotedString;
+	quotedString += '\'';
+	appendEscapedString( quotedString, str.data(), str.size() );
+	quotedString += '\'';
+	return quotedString;
+}
+
+#ifdef SQL_DATABASE_ASYNC
+AsyncQuery _Connection::sendQueryAsync( const std::string &queryBuffer, std::function< void( AsyncQuery ) > callback )
+{
+	checkAvailable();
+
+	Query query = std::make_shared< _Query >( queryBuffer, this );
+
+	AsyncQuery asyncQuery = std::make_shared< _AsyncQuery >( this, query, callback );
+	activeAsyncQuery = asyncQuery.get();
+
+	const std::string &request = query->request;
+	asyncQuery->advance( mysql_real_query_start( &asyncQuery->queryStatus, server, request.data(), (unsigned long)request.size() ) );
+	return asyncQuery;
+}
+
+/************* Async Query Member Function Implementations ************/
+
+_AsyncQuery::_AsyncQuery( _Connection *connection, Query query, std::function< void( AsyncQuery ) > callback )
+{
+	this->server = connection;
+	this->query = query;
+	this->callback = callback;
+	this->state = Querying;
+	this->waitEvents = 0;
+	this->queryStatus = 0;
+	this->result = NULL;
+	this->started = std::chrono::steady_clock::now();
+}
+
+//A query that is dropped mid-flight still has to finish, or the connection would be left out of sync.
+_AsyncQuery::~_AsyncQuery()
+{
+	callback = nullptr;
+	try {
+		if( state != Done && server )
+			wait();
+	} catch( QueryException &e ) {
+	}
+	if( server && server->activeAsyncQuery == this )
+		server->activeAsyncQuery = NULL;
+}
+
+//Run the query's steps until one has to wait on the socket, or the query is done.
+//	The first result is kept. The results of any later statements are read and freed, as
+//	sendQuery() does, so the connection is ready for the next query.
+void _AsyncQuery::advance( int status )
+{
+	while( state != Done )
+	{
+		if( status != 0 )
+		{
+			waitEvents = status;
+			return;
+		}
+		waitEvents = 0;
+
+		if( state == Querying )
+		{
+			if( queryStatus != 0 )
+			{
+				fail( "Failed to send query." );
+				return;
+			}
+			state = StoringResult;
+			status = mysql_store_result_start( &result, server->server );
+			continue;
+		}
+
+		if( state == NextResult )
+		{
+			if( queryStatus > 0 )
+			{
+				fail( "A later statement in the query failed." );
+				return;
+			}
+			if( queryStatus < 0 )
+			{
+				complete();
+				return;
+			}
+			state = StoringLaterResult;
+			status = mysql_store_result_start( &result, server->server );
+			continue;
+		}
+
+		//StoringResult or StoringLaterResult: if there is no result, it was either a statement without one or an error.
+		if( !result && mysql_field_count( server->server ) != 0 )
+		{
+			fail( state == StoringResult ? "Failed to read query result." : "A later statement in the query failed." );
+			return;
+		}
+		if( state == StoringResult )
+		{
+			query->setResultSet( result );
+			query->loadResult();
+		}
+		else if( result )
+			mysql_free_result( result );
+		result = NULL;
+
+		state = NextResult;
+		status = mysql_next_result_start( &queryStatus, server->server );
+	}
+}
+
+void _AsyncQuery::fail( const std::string &message )
+{
+	error = QueryException( message, server ? server->server : NULL, query->getQueryBuffer().c_str() );
+	complete();
+}
+
+void _AsyncQuery::complete()
+{
+	state = Done;
+	waitEvents = 0;
+	if( server )
+	{
+		//The steps of a non-blocking query overlap with the caller's own work, so only the total is known.
+		QueryTiming timing;
+		timing.execute = std::chrono::duration_cast< std::chrono::microseconds >( std::chrono::steady_clock::now() - started );
+		timing.failed = error.has_value();
+		server->recordQuery( query->request.data(), query->request.size(), timing );
+	}
+	if( server && server->activeAsyncQuery == this )
+		server->activeAsyncQuery = NULL;
+
+	if( callback )
+	{
+		std::function< void( AsyncQuery ) > completed = callback;
+		callback = nullptr;
+		completed( shared_from_this() );
+	}
+}
+
+int _AsyncQuery::getSocket()
+{
+	return server ? (int)mysql_get_socket( server->server ) : -1;
+}
+
+unsigned int _AsyncQuery::getTimeout()
+{
+	return server ? mysql_get_timeout_value_ms( server->server ) : 0;
+}
+
+bool _AsyncQuery::poll( const int readyEvents )
+{
+	if( state == Done )
+		return true;
+	if( !server )
+		throw QueryException("There is no MySQL server connection for this query object.");
+
+	if( state == Querying )
+		advance( mysql_real_query_cont( &queryStatus, server->server, readyEvents ) );
+	else if( state == NextResult )
+		advance( mysql_next_result_cont( &queryStatus, server->server, readyEvents ) );
+	else
+		advance( mysql_store_result_cont( &result, server->server, readyEvents ) );
+	return state == Done;
+}
+
+void _AsyncQuery::wait()
+{
+	while( state != Done )
+	{
+		struct pollfd descriptor;
+		descriptor.fd = getSocket();
+		descriptor.events = (wantsRead() ? POLLIN : 0) | (wantsWrite() ? POLLOUT : 0) | (waitEvents & MYSQL_WAIT_EXCEPT ? POLLPRI : 0);
+		descriptor.revents = 0;
+		int timeout = wantsTimeout() ? (int)getTimeout() : -1;
+#ifdef _WIN32
+		int ready = WSAPoll( &descriptor, 1, timeout );
+#else
+		int ready = ::poll( &descriptor, 1, timeout );
+#endif
+		int readyEvents = 0;
+		if( ready == 0 )
+			readyEvents = MYSQL_WAIT_TIMEOUT;
+		else if( ready > 0 )
+		{
+			if( descriptor.revents & (POLLIN | POLLHUP | POLLERR) ) readyEvents |= MYSQL_WAIT_READ;
+			if( descriptor.revents & POLLOUT ) readyEvents |= MYSQL_WAIT_WRITE;
+			if( descriptor.revents & POLLPRI ) readyEvents |= MYSQL_WAIT_EXCEPT;
+		}
+		else
+			continue;//Interrupted. Wait again.
+		poll( readyEvents );
+	}
+}
+
+Query _AsyncQuery::getResult()
+{
+	if( state != Done )
+		throw QueryException("The query has not completed yet.", NULL, query->getQueryBuffer().c_str());
+	if( error )
+		throw *error;
+	return query;
+}
+#endif
+
+/************* Write-Behind Queue Member Function Implementations ************/
+
+_WriteBehindQueue::_WriteBehindQueue( Connection connection, const size_t capacity, std::function< void( const std::string &, QueryException & ) > errorCallback )
+{
+	this->connection = connection;
+	this->errorCallback = errorCallback;
+	this->maxPacketSize = 1024 * 1024;
+
+	Query query = connection->sendQuery( "SELECT @@max_allowed_packet" );
+	if( query->hasNextRow() )
+		maxPacketSize = (size_t)query->getRow().getUnsignedLongLong( 0 );
+
+	//The ring's size is a power of two so positions map to cells with a mask.
+	size_t size = 2;
+	while( size < capacity )
+		size *= 2;
+	cells.reset( new Cell[ size ] );
+	for(size_t i = 0;i < size;++i)
+		cells[ i ].sequence.store( i, std::memory_order_relaxed );
+	mask = size - 1;
+
+	enqueuePosition.store( 0 );
+	dequeuePosition = 0;
+	executedPosition.store( 0 );
+	stopping.store( false );
+	drainerIdle.store( false );
+	groupCommitInterval.store( 0 );
+	commitRequested.store( false );
+
+	drainer = std::thread( &_WriteBehindQueue::drain, this );
+}
+
+//Everything already queued is still run before the queue goes away.
+_WriteBehindQueue::~_WriteBehindQueue()
+{
+	stopping.store( true );
+	{
+		std::lock_guard< std::mutex > lock( mutex );
+		workAvailable.notify_all();
+	}
+	if( drainer.joinable() )
+		drainer.join();
+}
+
+bool _WriteBehindQueue::tryEnqueue( std::string &statement )
+{
+	//Statements are joined with ';' into packets, where an empty one would fail the next in line.
+	size_t length = statementLength( statement );
+	if( length == 0 )
+		throw QueryException("A queued statement must not be empty.", NULL, statement.c_str());
+	statement.resize( length );
+
+	//Claim a cell by advancing the enqueue position, then publish the statement through its sequence.
+	size_t position = enqueuePosition.load( std::memory_order_relaxed );
+	Cell *cell;
+	while( true )
+	{
+		cell = &cells[ position & mask ];
+		size_t sequence = cell->sequence.load( std::memory_order_acquire );
+		intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+		if( difference == 0 )
+		{
+			if( enqueuePosition.compare_exchange_weak( position, position + 1, std::memory_order_relaxed ) )
+				break;
+		}
+		else if( difference < 0 )
+			return false;//The cell still holds a statement from one lap ago, so the queue is full.
+		else
+			position = enqueuePosition.load( std::memory_order_relaxed );
+	}
+	cell->statement = std::move( statement );
+	cell->sequence.store( position + 1, std::memory_order_release );
+
+	wakeDrainer();
+	return true;
+}
+
+void _WriteBehindQueue::enqueue( std::string statement )
+{
+	while( !tryEnqueue( statement ) )
+	{
+		//The drainer frees cells before it takes the mutex to signal, so the check cannot miss it.
+		std::unique_lock< std::mutex > lock( mutex );
+		spaceAvailable.wait( lock, [this]()
+		{
+			size_t position = enqueuePosition.load( std::memory_order_relaxed );
+			return (intptr_t)cells[ position & mask ].sequence.load( std::memory_order_acquire ) - (intptr_t)position >= 0;
+		} );
+	}
+}
+
+void _WriteBehindQueue::wakeDrainer()
+{
+	std::atomic_thread_fence( std::memory_order_seq_cst );
+	if( drainerIdle.load( std::memory_order_relaxed ) )
+	{
+		std::lock_guard< std::mutex > lock( mutex );
+		workAvailable.notify_one();
+	}
+}
+
+bool _WriteBehindQueue::tryPop( std::string &statement )
+{
+	Cell *cell = &cells[ dequeuePosition & mask ];
+	size_t sequence = cell->sequence.load( std::memory_order_acquire );
+	if( (intptr_t)sequence - (intptr_t)(dequeuePosition + 1) < 0 )
+		return false;
+
+	statement = std::move( cell->statement );
+	cell->statement.clear();
+	cell->sequence.store( dequeuePosition + mask + 1, std::memory_order_release );
+	++dequeuePosition;
+	return true;
+}
+
+void _WriteBehindQueue::flush()
+{
+	size_t target = enqueuePosition.load();
+	if( groupCommitInterval.load() > 0 )
+	{
+		commitRequested.store( true );
+		wakeDrainer();
+	}
+	std::unique_lock< std::mutex > lock( mutex );
+	statementsExecuted.wait( lock, [&](){ return executedPosition.load() >= target; } );
+}
+
+size_t _WriteBehindQueue::getPendingStatements()
+{
+	return enqueuePosition.load() - executedPosition.load();
+}
+
+//The background thread: gather as many queued statements as fit in one packet, and run them.
+//	When grouping commits, the statements run inside a transaction that is committed once
+//	the group's interval is up, and only then count as executed.
+void _WriteBehindQueue::drain()
+{
+	std::vector< std::string > statements;
+	std::string carried;
+	bool hasCarried = false;
+
+	std::vector< std::string > group;	//Statements run in the open group's transaction.
+	bool inGroup = false;
+	std::chrono::steady_clock::time_point groupDeadline;
+	size_t groupPosition = 0;	//Where executedPosition moves to once the group commits.
+
+	while( true )
+	{
+		size_t packetSize = 0;
+		statements.clear();
+		if( hasCarried )
+		{
+			packetSize = carried.size();
+			statements.push_back( std::move( carried ) );
+			hasCarried = false;
+		}
+		std::string statement;
+		while( tryPop( statement ) )
+		{
+			if( !statements.empty() && packetSize + statement.size() + 1 > maxPacketSize )
+			{
+				carried = std::move( statement );
+				hasCarried = true;
+				break;
+			}
+			packetSize += statement.size() + 1;
+			statements.push_back( std::move( statement ) );
+		}
+		const size_t runPosition = dequeuePosition - (hasCarried ? 1 : 0);
+
+		size_t next = 0;
+		while( next < statements.size() )
+		{
+			const std::chrono::milliseconds interval( groupCommitInterval.load() );
+			if( !inGroup && interval.count() > 0 && runControlStatement( "START TRANSACTION" ) )
+			{
+				inGroup = true;
+				groupDeadline = std::chrono::steady_clock::now() + interval;
+			}
+			size_t stopped = execute( statements, next, inGroup );
+			if( inGroup )
+			{
+				for(size_t i = next;i < stopped;++i)
+				{
+					if( !statements[ i ].empty() )
+						group.push_back( std::move( statements[ i ] ) );
+				}
+				if( !connection->isInTransaction() )
+				{
+					abandonGroup( group, "The server rolled back the group commit's transaction." );
+					inGroup = false;
+				}
+			}
+			next = stopped;
+		}
+		if( inGroup )
+			groupPosition = runPosition;
+
+		bool commitDue = inGroup && ( stopping.load() || commitRequested.load() || std::chrono::steady_clock::now() >= groupDeadline
+			|| groupCommitInterval.load() == 0 );
+		if( commitDue )
+		{
+			if( !runControlStatement( "COMMIT" ) )
+				abandonGroup( group, "The group commit's transaction failed to commit." );
+			group.clear();
+			inGroup = false;
+			commitRequested.store( false );
+		}
+		if( !statements.empty() || commitDue )
+		{
+			std::lock_guard< std::mutex > lock( mutex );
+			executedPosition.store( inGroup ? executedPosition.load() : std::max( runPosition, groupPosition ) );
+			statementsExecuted.notify_all();
+			spaceAvailable.notify_all();
+		}
+		if( !statements.empty() )
+			continue;
+		if( !inGroup )
+			commitRequested.store( false );
+		if( stopping.load() && !inGroup )
+			return;
+
+		//Nothing queued. Sleep until a producer wakes us, re-checking in case a wake-up was missed.
+		//	An open group also needs waking when its interval is up.
+		std::chrono::milliseconds wait( 50 );
+		if( inGroup )
+		{
+			std::chrono::steady_clock::duration left = groupDeadline - std::chrono::steady_clock::now();
+			wait = std::max( std::chrono::milliseconds(0), std::min( wait, std::chrono::duration_cast< std::chrono::milliseconds >( left ) ) );
+		}
+		std::unique_lock< std::mutex > lock( mutex );
+		drainerIdle.store( true );
+		std::atomic_thread_fence( std::memory_order_seq_cst );
+		Cell *cell = &cells[ dequeuePosition & mask ];
+		if( cell->sequence.load( std::memory_order_acquire ) != dequeuePosition + 1 && !stopping.load() && !commitRequested.load() )
+			workAvailable.wait_for( lock, wait );
+		drainerIdle.store( false );
+	}
+}
+
+//Send the statements from first on as one multi-statement packet. When one fails, the server
+//	skips the rest, so report it, clear it, and send the remainder again. In a group, a failure
+//	that took the transaction with it stops there, and the index after the failed statement
+//	is returned. Otherwise every statement has run and statements.size() is returned.
+size_t _WriteBehindQueue::execute( std::vector< std::string > &statements, size_t first, const bool inGroup )
+{
+	MYSQL *mysql = connection->server;
+	std::string packet;
+
+	while( first < statements.size() )
+	{
+		packet.clear();
+		for(size_t i = first;i < statements.size();++i)
+		{
+			if( i > first )
+				packet += ';';
+			packet += statements[ i ];
+		}
+
+		size_t completed = first;
+		QueryTiming timing;
+		std::optional< QueryException > error;
+		try {
+			if( !send( packet.data(), packet.size(), timing ) )
+				error = QueryException( "Failed to run queued statement.", connection->server, statements[ completed ].c_str() );
+		} catch( QueryException &e ) {
+			error = e;
+		}
+		mysql = connection->server;
+		std::chrono::steady_clock::time_point mark = std::chrono::steady_clock::now();
+		while( !error )
+		{
+			MYSQL_RES *result = mysql_store_result( mysql );
+			if( result )
+				mysql_free_result( result );
+			++completed;
+
+			int status = mysql_next_result( mysql );
+			if( status == -1 )
+				break;//Every statement has run.
+			if( status > 0 && completed < statements.size() )
+				error = QueryException( "Failed to run queued statement.", mysql, statements[ completed ].c_str() );
+			else if( status > 0 )
+				error = QueryException( "The server reported more statements than were sent.", mysql, packet.c_str() );
+		}
+		timing.fetch = lap( mark );
+		timing.failed = error.has_value();
+		connection->recordQuery( packet.data(), packet.size(), timing );
+
+		if( !error )
+			return statements.size();
+		if( completed >= statements.size() )
+		{
+			reportError( packet, *error );
+			return statements.size();
+		}
+		reportError( statements[ completed ], *error );
+		statements[ completed ].clear();
+		first = completed + 1;
+		reconnectIfLost();
+		if( inGroup && !connection->isInTransaction() )
+			return first;
+	}
+	return statements.size();
+}
+
+//Send a packet through the connection's own path, so that it is profiled, counted in the metrics
+//	and reconnected like any other query. Returns false if the first statement failed.
+bool _WriteBehindQueue::send( const char *packet, const size_t length, QueryTiming &timing )
+{
+	connection->checkAvailable();
+	return connection->runQuery( packet, length, timing ) == 0;
+}
+
+//The queue owns its connection, so when the server goes away, as after wait_timeout or a restart,
+//	it reconnects before sending anything more, whether or not auto-reconnect is turned on.
+//	If that fails too, the next packet tries again.
+void _WriteBehindQueue::reconnectIfLost()
+{
+	unsigned int error = connection->server ? mysql_errno( connection->server ) : CR_SERVER_GONE_ERROR;
+	if( error != CR_SERVER_GONE_ERROR && error != CR_SERVER_LOST && !connection->reconnectPending )
+		return;
+	try {
+		connection->reconnectWithBackoff();
+	} catch( ConnectionException &e ) {
+		e.report();
+	}
+}
+
+//Run a statement that begins or ends a group, reporting it if it fails.
+bool _WriteBehindQueue::runControlStatement( const char *statement )
+{
+	const size_t length = strlen( statement );
+	QueryTiming timing;
+	std::optional< QueryException > error;
+	try {
+		if( !send( statement, length, timing ) )
+			error = QueryException( "Failed to run a group commit statement.", connection->server, statement );
+	} catch( QueryException &e ) {
+		error = e;
+	}
+	timing.failed = error.has_value();
+	connection->recordQuery( statement, length, timing );
+	if( !error )
+		return true;
+	reportError( statement, *error );
+	reconnectIfLost();
+	return false;
+}
+
+//The group's statements ran but did not last, so pass each of them to the error callback.
+void _WriteBehindQueue::abandonGroup( std::vector< std::string > &group, const char *reason )
+{
+	for(size_t i = 0;i < group.size();++i)
+	{
+		QueryException e( reason, NULL, group[ i ].c_str() );
+		reportError( group[ i ], e );
+	}
+	group.clear();
+}
+
+void _WriteBehindQueue::reportError( const std::string &statement, QueryException &e )
+{
+	if( errorCallback )
+		errorCallback( statement, e );
+	else
+		e.report();
+}
+
+PreparedStatement _Connection::prepareStatement( const std::string &request )
+{
+	checkAvailable();
+	return std::make_shared< _PreparedStatement >( this, request );
+}
+
+Transaction _Connection::beginTransaction( const bool readOnly )
+{
+	return Transaction( this, readOnly );
+}
+bool _Connection::isInTransaction()
+{
+	return server && (server->server_status & SERVER_STATUS_IN_TRANS) != 0;
+}
+
+_Query::_Query()
+{
+	++numberOfAllocations;
+	resultSet = 0;
+	server = 0;
+	rowPosition = 0;
+	streaming = false;
+	streamFinished = false;
+	hasPendingRow = false;
+	pendingRow = NULL;
+	rowsStreamed = 0;
+}
+
+//Construct and send query automatically.
+_Query::_Query(std::string request, _Connection* connection)
+{ 
+	++numberOfAllocations;
+	this->request = std::move( request );
+	this->server = connection;
+	this->resultSet = 0;//No result yet.
+	this->rowPosition = 0;
+	this->streaming = false;
+	this->streamFinished = false;
+	this->hasPendingRow = false;
+	this->pendingRow = NULL;
+	this->rowsStreamed = 0;
+}
+
+_Query::~_Query()
+{
+	++numberOfDeallocations;
+	clearResultSet();//Just clear the result if one exists.
+}
+int _Query::getNumberOfAllocations()
+{
+	return (int)numberOfAllocations.get();
+}
+int _Query::getNumberOfDeallocations()
+{
+	return (int)numberOfDeallocations.get();
+}
+int _Query::getRemainder()
+{
+	return (int)(numberOfAllocations.get() - numberOfDeallocations.get());
+}
+
+/************* Insert Pipeline Member Function Implementations ************/
+
+_InsertPipeline::_InsertPipeline( ConnectionPool pool, const PipelineOptions &options )
+{
+	this->options = options;
+	unsigned int count = (options.ordered || options.connections == 0) ? 1 : options.connections;
+	if( options.transaction && count > 1 )
+		throw QueryException("A pipelined transaction needs a single worker: set ordered, or use one connection.");
+	for(unsigned int i = 0;i < count;++i)
+	{
+		leases.push_back( pool->checkout() );
+		connections.push_back( leases.back().get() );
+	}
+	startWorkers();
+}
+_InsertPipeline::_InsertPipeline( Connection connection, const PipelineOptions &options )
+{
+	this->options = options;
+	connections.push_back( connection );
+	startWorkers();
+}
+void _InsertPipeline::startWorkers()
+{
+	if( options.maxQueuedBatches == 0 )
+		options.maxQueuedBatches = 1;
+	sending = 0;
+	stopping = false;
+	commit = false;
+
+	//The workers share a server, so one of them speaks for all.
+	maxPacketSize = 1024 * 1024;
+	Query query = connections.front()->sendQuery( "SELECT @@max_allowed_packet" );
+	if( query->hasNextRow() )
+		maxPacketSize = (size_t)query->getRow().getUnsignedLongLong( 0 );
+
+	for(size_t i = 0;i < connections.size();++i)
+		workers.push_back( std::thread( &_InsertPipeline::run, this, connections[ i ] ) );
+}
+_InsertPipeline::~_InsertPipeline()
+{
+	stop( false );
+}
+
+void _InsertPipeline::submit( const char *batch, const size_t length )
+{
+	std::unique_lock< std::mutex > lock( mutex );
+	spaceAvailable.wait( lock, [this]{ return queued.size() < options.maxQueuedBatches || error; } );
+	if( error )
+		std::rethrow_exception( error );
+
+	std::string buffer;
+	if( !spareBuffers.empty() )
+	{
+		buffer = std::move( spareBuffers.back() );
+		spareBuffers.pop_back();
+	}
+	buffer.assign( batch, length );
+	queued.push_back( std::move( buffer ) );
+	batchQueued.notify_one();
+}
+
+void _InsertPipeline::finish()
+{
+	stop( true );
+	std::lock_guard< std::mutex > lock( mutex );
+	if( error )
+		std::rethrow_exception( error );
+}
+
+//Let the workers run through what is queued, or drop it, then wait for them to end.
+void _InsertPipeline::stop( const bool commit )
+{
+	{
+		std::lock_guard< std::mutex > lock( mutex );
+		if( stopping )
+			return;
+		stopping = true;
+		this->commit = commit;
+		if( !commit )
+			queued.clear();
+	}
+	batchQueued.notify_all();
+	for(size_t i = 0;i < workers.size();++i)
+		workers[ i ].join();
+	workers.clear();
+	//Hand pooled connections back now, rather than whenever the statement is destroyed.
+	leases.clear();
+	connections.clear();
+}
+
+size_t _InsertPipeline::getQueuedBatches()
+{
+	std::lock_guard< std::mutex > lock( mutex );
+	return queued.size();
+}
+
+void _InsertPipeline::run( Connection connection )
+{
+	bool inTransaction = false;
+	std::string batch;
+	while( true )
+	{
+		bool failed;
+		{
+			std::unique_lock< std::mutex > lock( mutex );
+			batchQueued.wait( lock, [this]{ return !queued.empty() || stopping; } );
+			if( queued.empty() )
+				break;
+			batch = std::move( queued.front() );
+			queued.pop_front();
+			failed = (error != nullptr);
+			++sending;
+		}
+		spaceAvailable.notify_one();
+
+		if( !failed )
+		{
+			try {
+				if( options.transaction && !inTransaction )
+				{
+					connection->sendRawQuery( "START TRANSACTION" );
+					inTransaction = true;
+				}
+				connection->sendRawQuery( batch );
+			} catch( ... ) {
+				std::lock_guard< std::mutex > lock( mutex );
+				if( !error )
+					error = std::current_exception();
+			}
+		}
+
+		std::lock_guard< std::mutex > lock( mutex );
+		spareBuffers.push_back( std::move( batch ) );
+		batch = std::string();
+		if( --sending == 0 )
+			batchSent.notify_all();
+		//A waiting caller has to see the failure, not wait for room that may never come.
+		if( error )
+			spaceAvailable.notify_all();
+	}
+
+	//Once every worker is done sending, whether any batch failed is settled.
+	if( inTransaction )
+	{
+		bool keep;
+		{
+			std::unique_lock< std::mutex > lock( mutex );
+			batchSent.wait( lock, [this]{ return sending == 0; } );
+			keep = commit && !error;
+		}
+		try {
+			connection->sendRawQuery( keep ? "COMMIT" : "ROLLBACK" );
+		} catch( ... ) {
+			std::lock_guard< std::mutex > lock( mutex );
+			if( !error )
+				error = std::current_exception();
+		}
+	}
+}
+
+/************* Query Member Function Implementations ************/
+
+//Set the API sql result
+void _Query::setResultSet( MYSQL_RES* resultSet )
+{
+	clearResultSet();
+	this->resultSet = resultSet;
+}
+//Return the API sql result
+MYSQL_RES* _Query::getResultSet()
+{
+	return resultSet;
+}
+//Add a row to the 'queue'.
+void _Query::addRow( MYSQL_ROW newRow )
+{
+	rows.push_back( newRow );//Add to the end of the 'queue'
+}
+//Reset the queue iterator to the beginning of the list.
+void _Query::resetRowQueue()
+{
+	if( streaming )
+		throw QueryException("A streaming query cannot be rewound.");
+	rowPosition = 0;
+}
+//Reverse the rows in the queue.
+void _Query::reverseRows()
+{
+	if( streaming )
+		throw QueryException("A streaming query cannot be reversed.");
+	std::reverse( rows.begin(), rows.end() );
+	//Each row's lengths move with it.
+	size_t nr_fields = fields.size();
+	for(size_t front = 0, back = rows.size();front + 1 < back;++front, --back)
+	{
+		std::swap_ranges( lengths.begin() + front * nr_fields, lengths.begin() + (front + 1) * nr_fields,
+			lengths.begin() + (back - 1) * nr_fields );
+	}
+	resetRowQueue();
+}
+//Make sure the next streamed row, if there is one, has been read from the server.
+bool _Query::fetchStreamRow()
+{
+	if( hasPendingRow )
+		return true;
+	if( streamFinished || !resultSet )
+		return false;
+	if( !server )
+		throw QueryException("There is no MySQL server connection for this query object.");
+
+	pendingRow = mysql_fetch_row( resultSet );
+	if( pendingRow == NULL )
+	{
+		//The end of the stream and a read error look the same, so check the connection.
+		MYSQL *mysql = server->server;
+		finishStream();
+		if( mysql_errno( mysql ) != 0 )
+			throw QueryException("Failed to read a row from the stream.", mysql, request.c_str());
+		return false;
+	}
+	unsigned long *rowLengths = mysql_fetch_lengths( resultSet );
+	pendingLengths.assign( rowLengths, rowLengths + fields.size() );
+	hasPendingRow = true;
+	++rowsStreamed;
+
+	size_t bytes = 0;
+	for(size_t i = 0;i < pendingLengths.size();++i)
+		bytes += pendingLengths[ i ];
+	server->recordRows( 1, bytes );
+	return true;
+}
+//All rows have been read, so the connection can be handed back.
+void _Query::finishStream()
+{
+	streamFinished = true;
+	hasPendingRow = false;
+	if( server )
+		server->releaseStream( this );
+}
+//Stop reading a stream early. Remaining rows are discarded by the client library.
+void _Query::closeStream()
+{
+	if( !streaming )
+		return;
+	if( resultSet )
+	{
+		mysql_free_result( resultSet );
+		resultSet = 0;
+	}
+	finishStream();
+}
+//Grab all fields from the sql query result.
+void _Query::setupFields()
+{
+	if( fields.size() )
+		return;//Fields are already set up.
+
+	MYSQL_FIELD* mysqlFields = mysql_fetch_fields( getResultSet() ); //This is deleted in mysql_free_result()
+	unsigned int nr_fields = mysql_num_fields( getResultSet() );
+
+	if( !mysqlFields )
+	{
+		throw FieldException("No fields found");
+	}
+	for(unsigned int i = 0;i < nr_fields;++i)
+	{
+		if(mysqlFields[i].name)
+			fields.add( mysqlFields[i].name );
+		else if(mysqlFields[i].org_name)
+			fields.add( mysqlFields[i].org_name );
+		else
+			fields.add( std::string("") );
+	}
+
+}
+//Send the query to the database server.
+Query _Query::send()
+{
+	//A query made with new is owned from here on, as it always has been.
+	Query query = weak_from_this().lock();
+	if( !query )
+		query = Query( this );
+
+	if(this->server) server->sendQuery( query );
+
+	loadResult();
+	return query;
+}
+//Read the rows of the result that was just stored.
+void _Query::loadResult()
+{
+	//Rows of a streaming query are read as they are requested.
+	//	Queries without a result never reserve the connection.
+	if( streaming )
+	{
+		if( getResultSet() )
+			setupFields();
+		else
+			streamFinished = true;
+		return;
+	}
+
+	//The following only occurs if there was a result from the query.
+	//Non-resulting queries have no data to store.
+	if ( getResultSet() )
+	{
+		unsigned int nr_rows = (unsigned int)mysql_num_rows( getResultSet() );
+		setupFields();
+
+		unsigned int nr_fields = (unsigned int)fields.size();
+
+		rows.reserve( nr_rows );
+		lengths.resize( (size_t)nr_rows * nr_fields );
+		for(unsigned int i = 0;i < nr_rows;++i)
+		{
+			addRow( mysql_fetch_row( getResultSet() ) );
+			//The library reuses its length array for every row, so keep a copy.
+			unsigned long *rowLengths = mysql_fetch_lengths( getResultSet() );
+			if( rowLengths )
+				memcpy( lengths.data() + (size_t)i * nr_fields, rowLengths, sizeof(unsigned long) * nr_fields );
+		}
+		if( server )
+		{
+			size_t bytes = 0;
+			for(size_t i = 0;i < lengths.size();++i)
+				bytes += lengths[ i ];
+			server->recordRows( nr_rows, bytes );
+		}
+	}
+	rowPosition = 0;
+}
+//Clear out the result data & all corresponding data.
+void _Query::clearResultSet()
+{
+	if(this->resultSet)//If no result, then there is nothing being stored!
+	{
+		mysql_free_result( resultSet );//Free API sql result
+		resultSet = 0;	
+		if( streaming )
+			finishStream();
+
+		rows.clear();//Clear rows
+		lengths.clear();
+		rowPosition = 0;
+		fields.clear();//Clear field names & indexes
+	}
+}
+
+std::string _Query::getFieldByIndex( const int index ) const
+{
+	if( index < 0 || (size_t)index >= fields.size() )
+		return std::string("");
+	return fields.getName( index );
+}
+//Grab the next row in the 'queue' and move on to the next.
+Row _Query::getRow()
+{
+	if( !resultSet )
+		throw QueryException("There is no MySQL query result stored.");
+	if( streaming )
+	{
+		if( !server )
+			throw QueryException("There is no MySQL server connection for this query object.");
+		if( !fetchStreamRow() )
+			throw QueryException("The stream has no more rows.");
+		hasPendingRow = false;
+		return Row(weak_from_this().lock(), pendingRow, pendingLengths.data());
+	}
+	if( rowPosition >= rows.size() )//We're at the end of the queue. Must be reset.
+		throw QueryException("The cursor is at the end of the row queue.");
+
+	const size_t position = rowPosition++;//Grab this row & iterate
+	return Row( weak_from_this().lock(), rows[ position ], getRowLengths( position ) );
+}
+//Grab any row by its position in the result. The cursor is not moved.
+Row _Query::getRow( const size_t index ) const
+{
+	if( streaming )
+		throw QueryException("Rows of a streaming query cannot be accessed by position.");
+	if( !resultSet )
+		throw QueryException("There is no MySQL query result stored.");
+	if( index >= rows.size() )
+		throw QueryException("The row index is past the end of the result.");
+
+	return Row( weak_from_this().lock(), rows[ index ], getRowLengths( index ) );
+}
+//Move the cursor so that the next getRow() returns the row at this position.
+void _Query::seekRow( const size_t index )
+{
+	if( streaming )
+		throw QueryException("A streaming query cannot be seeked.");
+	if( index > rows.size() )
+		throw QueryException("The row index is past the end of the result.");
+	rowPosition = index;
+}
+//Grab the next row in the 'queue' without iterating.
+Row _Query::peekRow()
+{
+	if( !resultSet )
+		throw QueryException("There is no MySQL query result stored.");
+	if( streaming )
+	{
+		if( !server )
+			throw QueryException("There is no MySQL server connection for this query object.");
+		if( !fetchStreamRow() )
+			throw QueryException("The stream has no more rows.");
+		return Row(weak_from_this().lock(), pendingRow, pendingLengths.data());
+	}
+	if( rowPosition >= rows.size() )//We're at the end of the queue. Must be reset.
+		throw QueryException("The cursor is at the end of the row queue.");
+
+	return Row( weak_from_this().lock(), rows[ rowPosition ], getRowLengths( rowPosition ) );//Grab this row
+}
+MaterializedResult _Query::materialize() const
+{
+	if( streaming )
+		throw QueryException("A streaming query cannot be materialized.", NULL, request.c_str());
+	if( !resultSet )
+		throw QueryException("There is no MySQL query result stored.", NULL, request.c_str());
+
+	MaterializedResult result = std::make_shared< _MaterializedResult >();
+	result->fill( rows, lengths, fields );
+	result->request = request;
+	return result;
+}
+
+/************* Materialized Result Member Function Implementations ************/
+
+_MaterializedResult::_MaterializedResult()
+{
+	this->rowCount = 0;
+	this->fieldCount = 0;
+	this->wordsPerColumn = 0;
+	this->arenaSize = 0;
+	this->nullBits = NULL;
+	this->offsets = NULL;
+	this->data = NULL;
+}
+
+//Copy the rows into the arena. lengths holds fields.size() lengths per row.
+void _MaterializedResult::fill( const std::vector< MYSQL_ROW > &rows, const std::vector< unsigned long > &lengths, const sqlFieldSet &fields )
+{
+	const size_t rowCount = rows.size();
+	const size_t fieldCount = fields.size();
+
+	size_t dataSize = 0;
+	for(size_t i = 0;i < lengths.size();++i)
+		dataSize += lengths[ i ] + 1;
+
+	//A single allocation holds everything, laid out so each part stays aligned.
+	const size_t wordsPerColumn = (rowCount + 63) / 64;
+	const size_t bitmapBytes = fieldCount * wordsPerColumn * sizeof(uint64_t);
+	const size_t offsetBytes = fieldCount * (rowCount + 1) * sizeof(size_t);
+	this->arenaSize = bitmapBytes + offsetBytes + dataSize;
+	this->arena.reset( new unsigned char[ arenaSize ? arenaSize : 1 ] );
+
+	uint64_t *nullBits = reinterpret_cast< uint64_t* >( arena.get() );
+	size_t *offsets = reinterpret_cast< size_t* >( arena.get() + bitmapBytes );
+	char *data = reinterpret_cast< char* >( arena.get() + bitmapBytes + offsetBytes );
+	memset( nullBits, 0, bitmapBytes );
+
+	size_t position = 0;
+	for(size_t column = 0;column < fieldCount;++column)
+	{
+		size_t *columnOffsets = offsets + column * (rowCount + 1);
+		uint64_t *columnNulls = nullBits + column * wordsPerColumn;
+		for(size_t row = 0;row < rowCount;++row)
+		{
+			columnOffsets[ row ] = position;
+			const char *cell = rows[ row ][ column ];
+			if( cell == NULL )
+				columnNulls[ row / 64 ] |= (uint64_t)1 << (row % 64);
+			const unsigned long length = cell ? lengths[ row * fieldCount + column ] : 0;
+			if( length )
+				memcpy( data + position, cell, length );
+			data[ position + length ] = '\0';
+			position += length + 1;
+		}
+		columnOffsets[ rowCount ] = position;
+	}
+
+	this->rowCount = (unsigned int)rowCount;
+	this->fieldCount = (unsigned int)fieldCount;
+	this->wordsPerColumn = wordsPerColumn;
+	this->nullBits = nullBits;
+	this->offsets = offsets;
+	this->data = data;
+	this->fields = fields;
+}
+
+MaterializedResult _MaterializedResult::create( const std::vector< std::string > &fieldNames, const std::vector< std::vector< std::optional< std::string > > > &values )
+{
+	sqlFieldSet fields;
+	for(size_t i = 0;i < fieldNames.size();++i)
+		fields.add( fieldNames[ i ] );
+
+	std::vector< char* > cells( values.size() * fieldNames.size(), NULL );
+	std::vector< MYSQL_ROW > rows( values.size() );
+	std::vector< unsigned long > lengths( cells.size(), 0 );
+	for(size_t row = 0;row < values.size();++row)
+	{
+		if( values[ row ].size() != fieldNames.size() )
+			throw FieldException("Every row must have one value per field.");
+		rows[ row ] = cells.data() + row * fieldNames.size();
+		for(size_t column = 0;column < fieldNames.size();++column)
+		{
+			const std::optional< std::string > &value = values[ row ][ column ];
+			if( !value )
+				continue;
+			//Only read from, while filling the arena.
+			rows[ row ][ column ] = const_cast< char* >( value->data() );
+			lengths[ row * fieldNames.size() + column ] = (unsigned long)value->size();
+		}
+	}
+
+	MaterializedResult result = std::make_shared< _MaterializedResult >();
+	result->fill( rows, lengths, fields );
+	return result;
+}
+
+int _MaterializedResult::getIndexByField( const std::string &field ) const
+{
+	int index = fields.find( field );
+	if( index < 0 )
+		throw FieldException("The result has no field named '" + field + "'.");
+	return index;
+}
+
+std::string _MaterializedResult::getFieldByIndex( const int index ) const
+{
+	if( index < 0 || (size_t)index >= fields.size() )
+		return std::string("");
+	return fields.getName( index );
+}
+
+//The start of a snapshot file. The arena follows the names, aligned for its offsets, exactly as
+//	it is laid out in memory, so that open() can point into the mapping.
+struct SnapshotHeader
+{
+	char magic[8];
+	uint32_t formatVersion;
+	uint32_t byteOrder;	//snapshotByteOrder as written, to reject files from the other endianness.
+	uint32_t wordSize;	//sizeof(size_t), the width of the stored offsets.
+	uint32_t rowCount;
+	uint32_t fieldCount;
+	uint32_t reserved;
+	uint64_t namesSize;	//The field names, the query and the version, each a 32 bit length and its bytes.
+	uint64_t arenaOffset;
+	uint64_t arenaSize;
+	uint64_t checksum;	//Of the names, then the arena.
+};
+static const char snapshotMagic[8] = { 'S', 'Q', 'L', 'S', 'N', 'A', 'P', '\0' };
+static const uint32_t snapshotFormatVersion = 1;
+static const uint32_t snapshotByteOrder = 0x01020304;
+
+//A 64 bit hash over four interleaved lanes of words, so it runs at memory speed rather than
+//	at the latency of one multiply per byte. Only for catching damaged files.
+static uint64_t snapshotChecksum( const unsigned char *bytes, const size_t size, const uint64_t seed )
+{
+	const uint64_t prime = 0x9E3779B97F4A7C15ULL;
+	uint64_t lanes[4] = { seed, seed ^ 0x6A09E667F3BCC908ULL, seed ^ 0xBB67AE8584CAA73BULL, seed ^ 0x3C6EF372FE94F82BULL };
+	size_t i = 0;
+	for(;i + 32 <= size;i += 32)
+	{
+		for(int lane = 0;lane < 4;++lane)
+		{
+			uint64_t word;
+			memcpy( &word, bytes + i + lane * 8, 8 );
+			lanes[ lane ] = (lanes[ lane ] ^ word) * prime;
+			lanes[ lane ] ^= lanes[ lane ] >> 29;
+		}
+	}
+	uint64_t hash = size;
+	for(int lane = 0;lane < 4;++lane)
+		hash = (hash ^ lanes[ lane ]) * prime;
+	for(;i < size;++i)
+		hash = (hash ^ bytes[ i ]) * prime;
+	return hash ^ (hash >> 32);
+}
+
+static void appendSnapshotString( std::string &names, const std::string &value )
+{
+	uint32_t length = (uint32_t)value.size();
+	names.append( reinterpret_cast< const char* >( &length ), sizeof(length) );
+	names += value;
+}
+static bool readSnapshotString( const unsigned char *&position, const unsigned char *end, std::string &value )
+{
+	uint32_t length;
+	if( (size_t)(end - position) < sizeof(length) )
+		return false;
+	memcpy( &length, position, sizeof(length) );
+	position += sizeof(length);
+	if( (size_t)(end - position) < length )
+		return false;
+	value.assign( reinterpret_cast< const char* >( position ), length );
+	position += length;
+	return true;
+}
+
+//Write the parts to a new file beside path, under a name no other thread or process is using,
+//	and flush it to disk, so that it can be renamed over path. Returns the file's name.
+static std::string writeSnapshotTemporary( const std::string &path, const std::pair< const void*, size_t > *parts, const size_t partCount )
+{
+#ifdef _WIN32
+	static std::atomic< unsigned int > temporaryCount( 0 );
+	const std::string temporaryPath = path + "." + std::to_string( GetCurrentProcessId() ) + "." + std::to_string( ++temporaryCount ) + ".tmp";
+	HANDLE file = CreateFileA( temporaryPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL );
+	if( file == INVALID_HANDLE_VALUE )
+		throw QueryException("Failed to create the snapshot file '" + temporaryPath + "'.");
+	bool written = true;
+	for(size_t i = 0;i < partCount && written;++i)
+	{
+		const char *bytes = static_cast< const char* >( parts[ i ].first );
+		size_t left = parts[ i ].second;
+		while( left > 0 && written )
+		{
+			DWORD count = 0;
+			written = WriteFile( file, bytes, (DWORD)std::min< size_t >( left, 1 << 30 ), &count, NULL ) != 0;
+			bytes += count;
+			left -= count;
+		}
+	}
+	if( written )
+		written = FlushFileBuffers( file ) != 0;
+	if( !CloseHandle( file ) )
+		written = false;
+#else
+	std::string temporaryPath = path + ".XXXXXX";
+	int file = mkstemp( &temporaryPath[0] );
+	if( file < 0 )
+		throw QueryException("Failed to create the snapshot file '" + temporaryPath + "'.");
+	//mkstemp() makes the file private to its owner. It is replacing a file others may read.
+	bool written = fchmod( file, 0644 ) == 0;
+	for(size_t i = 0;i < partCount && written;++i)
+	{
+		const char *bytes = static_cast< const char* >( parts[ i ].first );
+		size_t left = parts[ i ].second;
+		while( left > 0 && written )
+		{
+			ssize_t count = write( file, bytes, left );
+			if( count < 0 && errno == EINTR )
+				continue;
+			written = count > 0;
+			if( written )
+			{
+				bytes += count;
+				left -= (size_t)count;
+			}
+		}
+	}
+	if( written )
+		written = fsync( file ) == 0;
+	if( close( file ) != 0 )
+		written = false;
+#endif
+	if( !written )
+	{
+		remove( temporaryPath.c_str() );
+		throw QueryException("Failed to write the snapshot file '" + temporaryPath + "'.");
+	}
+	return temporaryPath;
+}
+
+void _MaterializedResult::save( const std::string &path, const std::string &version ) const
+{
+	std::string names;
+	for(size_t i = 0;i < fields.size();++i)
+		appendSnapshotString( names, fields.getName( (int)i ) );
+	appendSnapshotString( names, request );
+	appendSnapshotString( names, version );
+
+	const unsigned char *arenaStart = reinterpret_cast< const unsigned char* >( nullBits );
+	SnapshotHeader header;
+	memset( &header, 0, sizeof(header) );
+	memcpy( header.magic, snapshotMagic, sizeof(header.magic) );
+	header.formatVersion = snapshotFormatVersion;
+	header.byteOrder = snapshotByteOrder;
+	header.wordSize = (uint32_t)sizeof(size_t);
+	header.rowCount = rowCount;
+	header.fieldCount = fieldCount;
+	header.namesSize = names.size();
+	header.arenaOffset = (sizeof(header) + names.size() + 7) & ~(uint64_t)7;
+	header.arenaSize = arenaSize;
+	header.checksum = snapshotChecksum( arenaStart, arenaSize,
+		snapshotChecksum( reinterpret_cast< const unsigned char* >( names.data() ), names.size(), 0 ) );
+	names.append( (size_t)(header.arenaOffset - sizeof(header) - names.size()), '\0' );
+
+	const std::pair< const void*, size_t > parts[] = { { &header, sizeof(header) }, { names.data(), names.size() }, { arenaStart, arenaSize } };
+	const std::string temporaryPath = writeSnapshotTemporary( path, parts, 3 );
+#ifdef _WIN32
+	bool renamed = MoveFileExA( temporaryPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH ) != 0;
+#else
+	bool renamed = rename( temporaryPath.c_str(), path.c_str() ) == 0;
+	if( renamed )
+	{
+		//Make the rename itself durable, so a crash cannot bring back the old snapshot or none.
+		size_t slash = path.find_last_of( '/' );
+		std::string directory = slash == std::string::npos ? std::string(".") : path.substr( 0, slash ? slash : 1 );
+		int descriptor = ::open( directory.c_str(), O_RDONLY );
+		if( descriptor >= 0 )
+		{
+			fsync( descriptor );
+			close( descriptor );
+		}
+	}
+#endif
+	if( !renamed )
+	{
+		remove( temporaryPath.c_str() );
+		throw QueryException("Failed to replace the snapshot file '" + path + "'.");
+	}
+}
+
+//Map the whole file read only. The mapping stays valid after the file is closed.
+static std::shared_ptr< void > mapSnapshotFile( const std::string &path, size_t &size )
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if( file == INVALID_HANDLE_VALUE )
+		throw QueryException("Failed to open the snapshot file '" + path + "'.");
+	LARGE_INTEGER fileSize;
+	if( !GetFileSizeEx( file, &fileSize ) || (unsigned long long)fileSize.QuadPart < sizeof(SnapshotHeader) )
+	{
+		CloseHandle( file );
+		throw QueryException("The snapshot file '" + path + "' is truncated.");
+	}
+	size = (size_t)fileSize.QuadPart;
+	HANDLE fileMapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+	CloseHandle( file );
+	void *view = fileMapping ? MapViewOfFile( fileMapping, FILE_MAP_READ, 0, 0, 0 ) : NULL;
+	if( fileMapping )
+		CloseHandle( fileMapping );
+	if( !view )
+		throw QueryException("Failed to map the snapshot file '" + path + "'.");
+	return std::shared_ptr< void >( view, []( void *view ) { UnmapViewOfFile( view ); } );
+#else
+	int file = ::open( path.c_str(), O_RDONLY );
+	if( file < 0 )
+		throw QueryException("Failed to open the snapshot file '" + path + "'.");
+	struct stat status;
+	if( fstat( file, &status ) != 0 || (size_t)status.st_size < sizeof(SnapshotHeader) )
+	{
+		close( file );
+		throw QueryException("The snapshot file '" + path + "' is truncated.");
+	}
+	size = (size_t)status.st_size;
+	void *view = mmap( NULL, size, PROT_READ, MAP_PRIVATE, file, 0 );
+	close( file );
+	if( view == MAP_FAILED )
+		throw QueryException("Failed to map the snapshot file '" + path + "'.");
+	return std::shared_ptr< void >( view, [size]( void *view ) { munmap( view, size ); } );
+#endif
+}
+
+MaterializedResult _MaterializedResult::open( const std::string &path, const bool verifyChecksum )
+{
+	size_t size = 0;
+	std::shared_ptr< void > mapping = mapSnapshotFile( path, size );
+	const unsigned char *file = static_cast< const unsigned char* >( mapping.get() );
+
+	SnapshotHeader header;
+	memcpy( &header, file, sizeof(header) );
+	if( memcmp( header.magic, snapshotMagic, sizeof(header.magic) ) != 0 || header.formatVersion != snapshotFormatVersion )
+		throw QueryException("The file '" + path + "' is not a snapshot.");
+	if( header.byteOrder != snapshotByteOrder || header.wordSize != sizeof(size_t) )
+		throw QueryException("The snapshot file '" + path + "' was written with a different byte order or word size.");
+
+	//Every size is checked against the file before anything is read through it.
+	const size_t wordsPerColumn = ((size_t)header.rowCount + 63) / 64;
+	const uint64_t bitmapBytes = (uint64_t)header.fieldCount * wordsPerColumn * sizeof(uint64_t);
+	const uint64_t offsetBytes = (uint64_t)header.fieldCount * ((uint64_t)header.rowCount + 1) * sizeof(size_t);
+	if( header.namesSize > size - sizeof(header) || header.arenaOffset % 8 != 0
+		|| header.arenaOffset < sizeof(header) + header.namesSize || header.arenaOffset > size
+		|| header.arenaSize != size - header.arenaOffset || header.arenaSize < bitmapBytes + offsetBytes )
+		throw QueryException("The snapshot file '" + path + "' is truncated.");
+
+	const unsigned char *names = file + sizeof(header);
+	const unsigned char *arenaStart = file + header.arenaOffset;
+	if( verifyChecksum && header.checksum != snapshotChecksum( arenaStart, (size_t)header.arenaSize, snapshotChecksum( names, (size_t)header.namesSize, 0 ) ) )
+		throw QueryException("The snapshot file '" + path + "' failed its checksum.");
+
+	MaterializedResult result = std::make_shared< _MaterializedResult >();
+	const unsigned char *position = names;
+	const unsigned char *namesEnd = names + header.namesSize;
+	std::string name;
+	for(uint32_t i = 0;i < header.fieldCount;++i)
+	{
+		if( !readSnapshotString( position, namesEnd, name ) )
+			throw QueryException("The snapshot file '" + path + "' is damaged.");
+		result->fields.add( name );
+	}
+	if( !readSnapshotString( position, namesEnd, result->request ) || !readSnapshotString( position, namesEnd, result->version ) )
+		throw QueryException("The snapshot file '" + path + "' is damaged.");
+
+	//Cells are read through the offsets, so they are checked even without the checksum: in
+	//	order, each cell at least its terminating NUL long, and all within the data.
+	const size_t *offsets = reinterpret_cast< const size_t* >( arenaStart + bitmapBytes );
+	const size_t dataSize = (size_t)(header.arenaSize - bitmapBytes - offsetBytes);
+	const size_t offsetCount = (size_t)header.fieldCount * ((size_t)header.rowCount + 1);
+	size_t previousEnd = 0;
+	for(size_t i = 0;i < offsetCount;i += (size_t)header.rowCount + 1)
+	{
+		if( offsets[ i ] < previousEnd )
+			throw QueryException("The snapshot file '" + path + "' is damaged.");
+		for(size_t row = 0;row < header.rowCount;++row)
+		{
+			if( offsets[ i + row + 1 ] <= offsets[ i + row ] )
+				throw QueryException("The snapshot file '" + path + "' is damaged.");
+		}
+		previousEnd = offsets[ i + header.rowCount ];
+		if( previousEnd > dataSize )
+			throw QueryException("The snapshot file '" + path + "' is damaged.");
+	}
+
+	result->rowCount = header.rowCount;
+	result->fieldCount = header.fieldCount;
+	result->wordsPerColumn = wordsPerColumn;
+	result->arenaSize = (size_t)header.arenaSize;
+	result->nullBits = reinterpret_cast< const uint64_t* >( arenaStart );
+	result->offsets = offsets;
+	result->data = reinterpret_cast< const char* >( arenaStart + bitmapBytes + offsetBytes );
+	result->mapping = std::move( mapping );
+	return result;
+}
+
+/************* Prepared Statement Member Function Implementations ************/
+
+//Convert server date & time fields in local time to a unix timestamp, matching Row::getTimestamp().
+static time_t localTimestamp( const MYSQL_TIME &time )
+{
+	if( time.year == 0 && time.month == 0 && time.day == 0 )
+		return 0;
+	return makeLocalTimestamp( time.year, time.month, time.day, time.hour, time.minute, time.second );
+}
+
+_PreparedStatement::_PreparedStatement( _Connection *connection, const std::string &request )
+{
+	this->server = connection;
+	this->request = request;
+	this->metadata = NULL;
+	this->parametersChanged = true;
+	this->hasRow = false;
+
+	statement = mysql_stmt_init( server->server );
+	if( !statement )
+		throw QueryException("Failed to allocate a prepared statement.", server->server, request.c_str());
+
+	if( mysql_stmt_prepare( statement, request.c_str(), request.size() ) != 0 )
+	{
+		try {
+			throwError("Failed to prepare statement.");
+		} catch( QueryException &e ) {
+			mysql_stmt_close( statement );
+			throw;
+		}
+	}
+
+	//Parameter buffers are sized once so the addresses handed to the client library stay put.
+	unsigned long nr_parameters = mysql_stmt_param_count( statement );
+	parameterBinds.resize( nr_parameters );
+	parameters.resize( nr_parameters );
+	memset( parameterBinds.data(), 0, sizeof(MYSQL_BIND) * nr_parameters );
+	for(unsigned long i = 0;i < nr_parameters;++i)
+	{
+		parameters[ i ].bind = &parameterBinds[ i ];
+		parameters[ i ].isNull = 1;
+		parameterBinds[ i ].buffer_type = MYSQL_TYPE_NULL;
+		parameterBinds[ i ].is_null = &parameters[ i ].isNull;
+		parameterBinds[ i ].length = &parameters[ i ].length;
+	}
+
+	metadata = mysql_stmt_result_metadata( statement );
+	if( metadata )
+		setupResult();
+}
+
+_PreparedStatement::~_PreparedStatement()
+{
+	if( metadata ) mysql_free_result( metadata );
+	if( statement ) mysql_stmt_close( statement );
+}
+
+void _PreparedStatement::throwError( const std::string &message )
+{
+	QueryException exception( message );
+	exception.err = mysql_stmt_errno( statement );
+	exception.errorMessage = mysql_stmt_error( statement );
+
+	std::stringstream buff;
+	buff << message << "\n" << exception.errorMessage << ".  (#" << exception.err << ")\n";
+	buff << "Original query: " << request;
+	exception.message = buff.str();
+	throw exception;
+}
+
+//Choose a binary buffer for every result column based on its type.
+void _PreparedStatement::setupResult()
+{
+	MYSQL_FIELD* mysqlFields = mysql_fetch_fields( metadata );
+	unsigned int nr_fields = mysql_num_fields( metadata );
+
+	resultBinds.resize( nr_fields );
+	columns.resize( nr_fields );
+	memset( resultBinds.data(), 0, sizeof(MYSQL_BIND) * nr_fields );
+
+	for(unsigned int i = 0;i < nr_fields;++i)
+	{
+		MYSQL_BIND &bind = resultBinds[ i ];
+		ResultColumn &column = columns[ i ];
+
+		if(mysqlFields[i].name)
+			fields.add( mysqlFields[i].name );
+		else if(mysqlFields[i].org_name)
+			fields.add( mysqlFields[i].org_name );
+		else
+			fields.add( std::string("") );
+
+		bind.is_null = &column.isNull;
+		bind.length = &column.length;
+		bind.error = &column.error;
+
+		switch( mysqlFields[ i ].type )
+		{
+		case MYSQL_TYPE_TINY:
+		case MYSQL_TYPE_SHORT:
+		case MYSQL_TYPE_LONG:
+		case MYSQL_TYPE_INT24:
+		case MYSQL_TYPE_LONGLONG:
+		case MYSQL_TYPE_YEAR:
+			column.type = MYSQL_TYPE_LONGLONG;
+			bind.buffer = &column.integer;
+			bind.is_unsigned = (mysqlFields[ i ].flags & UNSIGNED_FLAG) != 0;
+			break;
+		case MYSQL_TYPE_FLOAT:
+		case MYSQL_TYPE_DOUBLE:
+			column.type = MYSQL_TYPE_DOUBLE;
+			bind.buffer = &column.real;
+			break;
+		case MYSQL_TYPE_DATE:
+		case MYSQL_TYPE_DATETIME:
+		case MYSQL_TYPE_TIMESTAMP:
+		case MYSQL_TYPE_TIME:
+			column.type = mysqlFields[ i ].type;
+			bind.buffer = &column.time;
+			break;
+		default:
+			//Decimals, strings, blobs, enums and anything else arrive as raw bytes.
+			column.type = MYSQL_TYPE_STRING;
+			break;
+		}
+		bind.buffer_type = column.type;
+	}
+}
+
+_PreparedStatement::Parameter &_PreparedStatement::getParameter( const unsigned int index, const enum_field_types type, const bool isUnsigned )
+{
+	if( index >= parameters.size() )
+		throw QueryException("The parameter index is past the end of the statement's parameters.", NULL, request.c_str());
+
+	Parameter &parameter = parameters[ index ];
+	MYSQL_BIND &bind = *parameter.bind;
+	if( bind.buffer_type != type || (bind.is_unsigned != 0) != isUnsigned )
+	{
+		bind.buffer_type = type;
+		bind.is_unsigned = isUnsigned;
+		parametersChanged = true;
+	}
+	parameter.isNull = 0;
+	return parameter;
+}
+
+unsigned int _PreparedStatement::numParameters()
+{
+	return (unsigned int)parameters.size();
+}
+unsigned int _PreparedStatement::numFields()
+{
+	return (unsigned int)columns.size();
+}
+my_ulonglong _PreparedStatement::numRows()
+{
+	return mysql_stmt_num_rows( statement );
+}
+my_ulonglong _PreparedStatement::lastInsertID()
+{
+	return mysql_stmt_insert_id( statement );
+}
+
+void _PreparedStatement::setNull( const unsigned int index )
+{
+	getParameter( index, MYSQL_TYPE_NULL, false ).isNull = 1;
+}
+void _PreparedStatement::setInt( const unsigned int index, const int value )
+{
+	setLongLong( index, value );
+}
+void _PreparedStatement::setUnsignedInt( const unsigned int index, const unsigned int value )
+{
+	setUnsignedLongLong( index, value );
+}
+void _PreparedStatement::setLongLong( const unsigned int index, const long long value )
+{
+	Parameter &parameter = getParameter( index, MYSQL_TYPE_LONGLONG, false );
+	parameter.integer = value;
+	if( parameter.bind->buffer != &parameter.integer )
+	{
+		parameter.bind->buffer = &parameter.integer;
+		parametersChanged = true;
+	}
+}
+void _PreparedStatement::setUnsignedLongLong( const unsigned int index, const unsigned long long value )
+{
+	Parameter &parameter = getParameter( index, MYSQL_TYPE_LONGLONG, true );
+	parameter.integer = (long long)value;
+	if( parameter.bind->buffer != &parameter.integer )
+	{
+		parameter.bind->buffer = &parameter.integer;
+		parametersChanged = true;
+	}
+}
+void _PreparedStatement::setBool( const unsigned int index, const bool value )
+{
+	setLongLong( index, encodeBooleanInt(value) );
+}
+void _PreparedStatement::setDouble( const unsigned int index, const double value )
+{
+	Parameter &parameter = getParameter( index, MYSQL_TYPE_DOUBLE, false );
+	parameter.real = value;
+	if( parameter.bind->buffer != &parameter.real )
+	{
+		parameter.bind->buffer = &parameter.real;
+		parametersChanged = true;
+	}
+}
+void _PreparedStatement::setString( const unsigned int index, const std::string &value )
+{
+	setString( index, value.data(), value.size() );
+}
+void _PreparedStatement::setString( const unsigned int index, const char *value, const size_t length )
+{
+	Parameter &parameter = getParameter( index, MYSQL_TYPE_STRING, false );
+	parameter.text.assign( value, length );
+	parameter.length = (unsigned long)length;
+	//Assigning may have moved the string's storage.
+	if( parameter.bind->buffer != parameter.text.data() )
+	{
+		parameter.bind->buffer = (void*)parameter.text.data();
+		parametersChanged = true;
+	}
+	parameter.bind->buffer_length = (unsigned long)parameter.text.capacity();
+}
+//A zero timestamp is stored as NULL, the same as encodeDate().
+void _PreparedStatement::setTimestamp( const unsigned int index, const time_t value )
+{
+	if( value == 0 )
+	{
+		setNull( index );
+		return;
+	}
+	tm timeInfo;
+#ifdef _WIN32
+	localtime_s( &timeInfo, &value );
+#else
+	localtime_r( &value, &timeInfo );
+#endif
+	Parameter &parameter = getParameter( index, MYSQL_TYPE_DATETIME, false );
+	memset( &parameter.time, 0, sizeof(MYSQL_TIME) );
+	parameter.time.year = timeInfo.tm_year + 1900;
+	parameter.time.month = timeInfo.tm_mon + 1;
+	parameter.time.day = timeInfo.tm_mday;
+	parameter.time.hour = timeInfo.tm_hour;
+	parameter.time.minute = timeInfo.tm_min;
+	parameter.time.second = timeInfo.tm_sec;
+	parameter.time.time_type = MYSQL_TIMESTAMP_DATETIME;
+	if( parameter.bind->buffer != &parameter.time )
+	{
+		parameter.bind->buffer = &parameter.time;
+		parametersChanged = true;
+	}
+}
+
+my_ulonglong _PreparedStatement::execute()
+{
+	server->checkAvailable();
+	hasRow = false;
+	if( metadata )
+		mysql_stmt_free_result( statement );
+
+	if( parametersChanged && !parameterBinds.empty() )
+	{
+		if( mysql_stmt_bind_param( statement, parameterBinds.data() ) != 0 )
+			throwError("Failed to bind statement parameters.");
+		parametersChanged = false;
+	}
+	//Parameters travel with the execute call, so sending is timed as part of executing.
+	QueryTiming timing;
+	std::chrono::steady_clock::time_point mark = std::chrono::steady_clock::now();
+	if( mysql_stmt_execute( statement ) != 0 )
+	{
+		timing.execute = lap( mark );
+		timing.failed = true;
+		server->recordQuery( request.data(), request.size(), timing );
+		throwError("Failed to execute statement.");
+	}
+	timing.execute = lap( mark );
+
+	if( metadata )
+	{
+		//Ask for the longest value of each column, so string buffers can be sized before fetching.
+		const sqlBindFlag updateMaxLength = 1;
+		mysql_stmt_attr_set( statement, STMT_ATTR_UPDATE_MAX_LENGTH, &updateMaxLength );
+		if( mysql_stmt_store_result( statement ) != 0 )
+		{
+			timing.fetch = lap( mark );
+			timing.failed = true;
+			server->recordQuery( request.data(), request.size(), timing );
+			throwError("Failed to store statement result.");
+		}
+
+		MYSQL_FIELD* mysqlFields = mysql_fetch_fields( metadata );
+		for(unsigned int i = 0;i < columns.size();++i)
+		{
+			if( columns[ i ].type != MYSQL_TYPE_STRING )
+				continue;
+			if( columns[ i ].text.size() < mysqlFields[ i ].max_length + 1 )
+				columns[ i ].text.resize( mysqlFields[ i ].max_length + 1 );
+			resultBinds[ i ].buffer = columns[ i ].text.data();
+			resultBinds[ i ].buffer_length = (unsigned long)columns[ i ].text.size();
+		}
+		if( mysql_stmt_bind_result( statement, resultBinds.data() ) != 0 )
+			throwError("Failed to bind statement result.");
+		server->recordRows( (size_t)mysql_stmt_num_rows( statement ), 0 );
+		timing.fetch = lap( mark );
+	}
+	server->recordQuery( request.data(), request.size(), timing );
+	return mysql_stmt_affected_rows( statement );
+}
+
+bool _PreparedStatement::fetch()
+{
+	if( !metadata )
+		return false;
+
+	int retval = mysql_stmt_fetch( statement );
+	if( retval == MYSQL_NO_DATA )
+	{
+		hasRow = false;
+		return false;
+	}
+	if( retval == MYSQL_DATA_TRUNCATED )
+	{
+		//A value grew past its buffer. Enlarge the buffer and read that column again.
+		for(unsigned int i = 0;i < columns.size();++i)
+		{
+			if( !columns[ i ].error || columns[ i ].type != MYSQL_TYPE_STRING )
+				continue;
+			columns[ i ].text.resize( columns[ i ].length + 1 );
+			resultBinds[ i ].buffer = columns[ i ].text.data();
+			resultBinds[ i ].buffer_length = (unsigned long)columns[ i ].text.size();
+			if( mysql_stmt_fetch_column( statement, &resultBinds[ i ], i, 0 ) != 0 )
+				throwError("Failed to fetch statement column.");
+		}
+		mysql_stmt_bind_result( statement, resultBinds.data() );
+	}
+	else if( retval != 0 )
+		throwError("Failed to fetch statement row.");
+
+	hasRow = true;
+	return true;
+}
+
+const _PreparedStatement::ResultColumn &_PreparedStatement::getColumn( const int index ) const
+{
+	if( !hasRow )
+		throw QueryException("There is no fetched row for this statement.", NULL, request.c_str());
+	if( index < 0 || (size_t)index >= columns.size() )
+		throw FieldException("The field index is past the end of the statement's result.");
+	return columns[ index ];
+}
+
+int _PreparedStatement::getIndexByField( const std::string &field )
+{
+	int index = fields.find( field );
+	if( index < 0 )
+		throw FieldException("The statement's result has no field named '" + field + "'.");
+	return index;
+}
+
+bool _PreparedStatement::isFieldNull( const int index ) const
+{
+	return getColumn( index ).isNull != 0;
+}
+
+long long _PreparedStatement::getLongLong( const int index ) const
+{
+	const ResultColumn &column = getColumn( index );
+	if( column.isNull )
+		return 0;
+	switch( column.type )
+	{
+	case MYSQL_TYPE_LONGLONG:
+		return column.integer;
+	case MYSQL_TYPE_DOUBLE:
+		return (long long)column.real;
+	case MYSQL_TYPE_STRING:
+		return parseInteger<long long>( column.text.data(), column.length );
+	default:
+		return (long long)localTimestamp( column.time );
+	}
+}
+
+double _PreparedStatement::getDouble( const int index ) const
+{
+	const ResultColumn &column = getColumn( index );
+	if( column.isNull )
+		return 0;
+	switch( column.type )
+	{
+	case MYSQL_TYPE_DOUBLE:
+		return column.real;
+	case MYSQL_TYPE_LONGLONG:
+		return resultBinds[ index ].is_unsigned ? (double)(unsigned long long)column.integer : (double)column.integer;
+	case MYSQL_TYPE_STRING:
+		return parseDouble( column.text.data(), column.length );
+	default:
+		return (double)localTimestamp( column.time );
+	}
+}
+
+std::string _PreparedStatement::getString( const int index ) const
+{
+	const ResultColumn &column = getColumn( index );
+	if( column.isNull )
+		return std::string("");
+
+	std::stringstream buff;
+	switch( column.type )
+	{
+	case MYSQL_TYPE_STRING:
+		return std::string( column.text.data(), column.length );
+	case MYSQL_TYPE_LONGLONG:
+		if( resultBinds[ index ].is_unsigned )
+			buff << (unsigned long long)column.integer;
+		else
+			buff << column.integer;
+		return buff.str();
+	case MYSQL_TYPE_DOUBLE:
+		buff << column.real;
+		return buff.str();
+	default:
+		{
+			char buffer[32];
+			const MYSQL_TIME &t = column.time;
+			if( column.type == MYSQL_TYPE_DATE )
+				snprintf( buffer, sizeof(buffer), "%04u-%02u-%02u", t.year, t.month, t.day );
+			else if( column.type == MYSQL_TYPE_TIME )
+				snprintf( buffer, sizeof(buffer), "%s%02u:%02u:%02u", t.neg ? "-" : "", t.hour, t.minute, t.second );
+			else
+				snprintf( buffer, sizeof(buffer), "%04u-%02u-%02u %02u:%02u:%02u", t.year, t.month, t.day, t.hour, t.minute, t.second );
+			return std::string( buffer );
+		}
+	}
+}
+
+time_t _PreparedStatement::getTimestamp( const int index ) const
+{
+	const ResultColumn &column = getColumn( index );
+	if( column.isNull )
+		return 0;
+	if( column.type == MYSQL_TYPE_STRING )
+		return parseTimestamp( column.text.data(), column.length );
+	if( column.type == MYSQL_TYPE_LONGLONG || column.type == MYSQL_TYPE_DOUBLE )
+		return (time_t)getLongLong( index );
+	return localTimestamp( column.time );
+}
+
+void BatchInsertStatement::init( Connection connection, const std::string &tableName, const unsigned int insertsPerFlush, bool insertIgnore )
+{
+	this->connection = connection;
+	this->tableName = tableName;
+	this->numberOfInserts = 0;
+	this->numberOfFieldsLoaded = 0;
+	this->insertsPerFlush = insertsPerFlush;
+	this->firstFieldThisEntry = false;
+	this->hasStarted = false;
+	this->headerLength = 0;
+	this->entryStart = 0;
+	this->maxBytesPerFlush = 0;
+
+	//Leave room under the server's packet limit for the packet header.
+	if( connection )
+	{
+		Query query = connection->sendQuery( "SELECT @@max_allowed_packet" );
+		if( query->hasNextRow() )
+		{
+			unsigned long long maxAllowedPacket = query->getRow().getUnsignedLongLong( 0 );
+			if( maxAllowedPacket > 1024 )
+				this->maxBytesPerFlush = (size_t)(maxAllowedPacket - 1024);
+		}
+	}
+
+	sql.reserve( 16 * 1024 );
+	sql += "INSERT";
+	sql += (insertIgnore ? " IGNORE" : "");
+	sql += " INTO ";
+	sql += tableName;
+	sql += "(";
+
+	this->firstField = true;
+}
+BatchInsertStatement::BatchInsertStatement()
+{
+	init( Connection(), "", 1000, false );
+}
+//The statement takes ownership of a connection given as a plain pointer, and deletes it when done.
+BatchInsertStatement::BatchInsertStatement( _Connection *connection, const std::string &tableName, const unsigned int insertsPerFlush )
+{
+	init( connection ? Connection( connection ) : Connection(), tableName, insertsPerFlush, false );
+}
+BatchInsertStatement::BatchInsertStatement( Connection connection, const std::string &tableName, const unsigned int insertsPerFlush )
+{
+	init( connection, tableName, insertsPerFlush, false );
+}
+
+BatchInsertStatement::BatchInsertStatement( Connection connection, const std::string &tableName, const unsigned int insertsPerFlush, bool insertIgnore )
+{
+	init( connection, tableName, insertsPerFlush, insertIgnore );
+}
+
+BatchInsertStatement::BatchInsertStatement( _Connection *connection, const std::string &tableName, const unsigned int insertsPerFlush, bool insertIgnore )
+{
+	init( connection ? Connection( connection ) : Connection(), tableName, insertsPerFlush, insertIgnore );
+}
+
+BatchInsertStatement::BatchInsertStatement( WriteBehindQueue queue, const std::string &tableName, const unsigned int insertsPerFlush, bool insertIgnore )
+{
+	init( Connection(), tableName, insertsPerFlush, insertIgnore );
+	this->writeBehindQueue = queue;
+	this->maxBytesPerFlush = queue->getMaxPacketSize() > 1024 ? queue->getMaxPacketSize() - 1024 : 0;
+}
+BatchInsertStatement::BatchInsertStatement( ConnectionPool pool, const std::string &tableName, const unsigned int insertsPerFlush,
+	const PipelineOptions &options, bool insertIgnore )
+{
+	init( Connection(), tableName, insertsPerFlush, insertIgnore );
+	this->pipeline = std::make_shared< _InsertPipeline >( pool, options );
+	this->maxBytesPerFlush = pipeline->getMaxPacketSize() > 1024 ? pipeline->getMaxPacketSize() - 1024 : 0;
+}
+BatchInsertStatement::BatchInsertStatement( Connection worker, const std::string &tableName, const unsigned int insertsPerFlush,
+	const PipelineOptions &options, bool insertIgnore )
+{
+	init( Connection(), tableName, insertsPerFlush, insertIgnore );
+	this->pipeline = std::make_shared< _InsertPipeline >( worker, options );
+	this->maxBytesPerFlush = pipeline->getMaxPacketSize() > 1024 ? pipeline->getMaxPacketSize() - 1024 : 0;
+}
+
+void BatchInsertStatement::start()
+{
+	sql += ")VALUES";
+	headerLength = sql.size();
+	hasStarted = true;
+}
+void BatchInsertStatement::flush()
+{
+	if( numberOfInserts > 0 ) {
+		sendBatch( sql.size() );
 	}
-	sql.str("");
-	sql << header;
+	//Keep the header and the buffer's capacity for the next batch.
+	sql.resize( headerLength );
 
 	numberOfInserts = 0;
 	firstField = false;
@@ -405,14 +3381,23 @@ void BatchInsertStatement::finish()
 	this->flush();
 
 	this->hasStarted = false;
-	this->sql.str("");
-	this->header.clear();
+	this->sql.clear();
+	this->headerLength = 0;
 	this->tableName.clear();
 	this->numberOfInserts = 0;
 	this->numberOfFieldsLoaded = 0;
 	this->insertsPerFlush = 0;
+	this->entryStart = 0;
 	this->firstFieldThisEntry = false;
 	this->hasStarted = false;
+
+	//Wait for the workers last, so the statement is reset even when a batch failed.
+	if( pipeline )
+	{
+		InsertPipeline finishing = pipeline;
+		pipeline.reset();
+		finishing->finish();
+	}
 }
 void BatchInsertStatement::addField( const std::string &field )
 {
@@ -420,129 +3405,733 @@ void BatchInsertStatement::addField( const std::string &field )
 		throw QueryException("Attempting to add field to a batch insert statement that has already started.");
 	}
 	if( !firstField )
-		sql << ",";
+		sql += ',';
 	else
 		firstField = false;
-	sql << field;
+	sql += field;
 }
 void BatchInsertStatement::beginEntry()
 {
 	this->firstFieldThisEntry = true;
+	this->entryStart = sql.size();
 
 	if( numberOfInserts > 0 )
-		sql << ",";
-	sql << "(";
+		sql += ',';
+	sql += '(';
 }
 void BatchInsertStatement::endEntry()
 {
 	++numberOfInserts;
-	sql << ")";
+	sql += ')';
 
-	if( numberOfInserts >= insertsPerFlush )
+	//This entry took the statement past the byte limit, so send the entries before it
+	//	and keep this one as the first entry of the next batch.
+	if( maxBytesPerFlush && sql.size() > maxBytesPerFlush && numberOfInserts > 1 )
+	{
+		sendBatch( entryStart );
+		sql.erase( headerLength, entryStart + 1 - headerLength );//Drop the sent entries and the comma.
+		numberOfInserts = 1;
+	}
+	if( numberOfInserts >= insertsPerFlush || (maxBytesPerFlush && sql.size() >= maxBytesPerFlush) )
 		flush();
 }
-void BatchInsertStatement::addFieldValue( const std::string &value )
+//Send the first length bytes of the statement, or queue them when writing behind or pipelining.
+void BatchInsertStatement::sendBatch( const size_t length )
+{
+	if( writeBehindQueue )
+		writeBehindQueue->enqueue( std::string( sql.data(), length ) );
+	else if( pipeline )
+		pipeline->submit( sql.data(), length );
+	else
+		connection->sendRawQuery( sql.data(), length );
+}
+//Separate this value from the previous one in the entry.
+void BatchInsertStatement::beginFieldValue()
 {
 	if( !firstFieldThisEntry )
-		sql << ",";
+		sql += ',';
 	else
 		firstFieldThisEntry = false;
-	sql << value;
 	++numberOfFieldsLoaded;
 }
+void BatchInsertStatement::addFieldValue( const std::string &value )
+{
+	beginFieldValue();
+	sql += value;
+}
 void BatchInsertStatement::putString( const char *value )
 {
-	if(value) {
-		putString(std::string(value));
-	}
-	else {
-		putString(std::string(""));
-	}
+	beginFieldValue();
+	appendQuotedString( sql, value ? value : "", value ? strlen(value) : 0 );
 }
 void BatchInsertStatement::putString( const std::string &value )
 {
-	addFieldValue(escapeQuoteString(value));
+	beginFieldValue();
+	appendQuotedString( sql, value.data(), value.size() );
 }
 void BatchInsertStatement::putInt( const int value )
 {
-	std::stringstream buf;
-	buf << value;
-	addFieldValue( buf.str() );
+	beginFieldValue();
+	appendInteger( sql, value );
 }
 void BatchInsertStatement::putLong( const long long value )
 {
-	std::stringstream buf;
-	buf << value;
-	addFieldValue( buf.str() );
+	beginFieldValue();
+	appendInteger( sql, value );
 }
 void BatchInsertStatement::putChar( char value )
 {
-	char buf[2];
-	sprintf(buf, "%c", value);
-	putString(buf);
+	//A NUL character is written as an empty string.
+	beginFieldValue();
+	appendQuotedString( sql, &value, value ? 1 : 0 );
 }
 void BatchInsertStatement::putBool( bool value )
 {
-	addFieldValue( value ? "1" : "0" );
+	beginFieldValue();
+	sql += (value ? '1' : '0');
 }
 void BatchInsertStatement::putDouble( double value )
 {
-	std::stringstream buf;
-	buf << value;
-	addFieldValue( buf.str() );
+	beginFieldValue();
+	appendDouble( sql, value );
+}
+void BatchInsertStatement::putDate( const time_t value )
+{
+	beginFieldValue();
+	appendQuotedDate( sql, value );
 }
 
-std::string escapeString(const std::string &str)
+/************* Bulk Loader Member Function Implementations ************/
+
+BulkLoader::BulkLoader( Connection connection, const std::string &tableName, bool replace )
 {
-	std::string escapedString = str;
-	::insertLetterBeforeLetter(escapedString, '\\', '\\');
-	::insertLetterBeforeLetter(escapedString, '\'', '\\');
-	return escapedString;
+	this->connection = connection;
+	this->tableName = tableName;
+	this->bytesPerFlush = 16 * 1024 * 1024;
+	this->replace = replace;
+	this->firstFieldThisEntry = false;
+	this->hasStarted = false;
+	this->rowsLoaded = 0;
+	this->warningCount = 0;
+}
+void BulkLoader::addField( const std::string &field )
+{
+	if( hasStarted )
+		throw QueryException("Attempting to add field to a bulk load that has already started.");
+	if( !fields.empty() )
+		fields += ',';
+	fields += field;
+}
+void BulkLoader::start()
+{
+	//Spell out the format rather than rely on the defaults, which the server can change.
+	statement = "LOAD DATA LOCAL INFILE '";
+	statement += fileName;
+	statement += (replace ? "' REPLACE" : "' IGNORE");
+	statement += " INTO TABLE ";
+	statement += tableName;
+	//Without this the server reads the text in the database's character set, not the connection's.
+	if( connection && connection->getCharacterSet() )
+	{
+		statement += " CHARACTER SET ";
+		statement += connection->getCharacterSet();
+	}
+	statement += " FIELDS TERMINATED BY '\\t' ESCAPED BY '\\\\' LINES TERMINATED BY '\\n'(";
+	statement += fields;
+	statement += ")";
+	hasStarted = true;
+}
+void BulkLoader::beginEntry()
+{
+	firstFieldThisEntry = true;
+}
+void BulkLoader::endEntry()
+{
+	buffer += '\n';
+	if( buffer.size() >= bytesPerFlush )
+		flush();
 }
+void BulkLoader::flush()
+{
+	if( buffer.empty() )
+		return;
+	if( !hasStarted )
+		throw QueryException("Attempting to flush a bulk load that has not started.");
+	if( !connection )
+		throw QueryException("The bulk load has no connection to send its rows on.");
 
-std::string escapeQuoteString(const std::string &str)
+	unsigned int warnings = 0;
+	rowsLoaded += connection->loadLocalInfile( statement, buffer, warnings );
+	warningCount += warnings;
+	buffer.clear();
+}
+void BulkLoader::finish()
+{
+	this->flush();
+	this->hasStarted = false;
+}
+//Separate this value from the previous one in the entry.
+void BulkLoader::beginFieldValue()
+{
+	if( !firstFieldThisEntry )
+		buffer += '\t';
+	else
+		firstFieldThisEntry = false;
+}
+//Escape the characters that would end the field or the line, a run of plain bytes at a time.
+void BulkLoader::appendEscaped( const char *value, const size_t length )
+{
+	size_t runStart = 0;
+	for(size_t i = 0;i < length;++i)
+	{
+		char replacement;
+		switch( value[ i ] )
+		{
+		case '\t': replacement = 't'; break;
+		case '\n': replacement = 'n'; break;
+		case '\r': replacement = 'r'; break;
+		case '\0': replacement = '0'; break;
+		case '\\': replacement = '\\'; break;
+		default: continue;
+		}
+		buffer.append( value + runStart, i - runStart );
+		buffer += '\\';
+		buffer += replacement;
+		runStart = i + 1;
+	}
+	buffer.append( value + runStart, length - runStart );
+}
+void BulkLoader::putNull()
+{
+	beginFieldValue();
+	buffer += "\\N";
+}
+void BulkLoader::putString( const std::string &value )
+{
+	beginFieldValue();
+	appendEscaped( value.data(), value.size() );
+}
+void BulkLoader::putString( const char *value )
+{
+	putString( value ? value : "", value ? strlen(value) : 0 );
+}
+void BulkLoader::putString( const char *value, const size_t length )
+{
+	beginFieldValue();
+	appendEscaped( value, length );
+}
+void BulkLoader::putInt( const int value )
+{
+	beginFieldValue();
+	appendInteger( buffer, value );
+}
+void BulkLoader::putLong( const long long value )
 {
-	return "'" + escapeString(str) + "'";
+	beginFieldValue();
+	appendInteger( buffer, value );
+}
+void BulkLoader::putUnsignedLong( const unsigned long long value )
+{
+	beginFieldValue();
+	appendUnsignedInteger( buffer, value );
+}
+void BulkLoader::putChar( char value )
+{
+	//A NUL character is written as an empty string, as BatchInsertStatement does.
+	beginFieldValue();
+	appendEscaped( &value, value ? 1 : 0 );
+}
+void BulkLoader::putBool( bool value )
+{
+	beginFieldValue();
+	buffer += (value ? '1' : '0');
+}
+void BulkLoader::putDouble( double value )
+{
+	beginFieldValue();
+	appendDouble( buffer, value );
+}
+void BulkLoader::putDate( const time_t value )
+{
+	//A zero timestamp is NULL, as it is for every other date encoder.
+	if( !value )
+		putNull();
+	else
+	{
+		beginFieldValue();
+		appendDate( buffer, value );
+	}
 }
 
-std::string encodeQuoteDate(const time_t unixTimestamp)
+/************* Transaction Member Function Implementations ************/
+
+Transaction::Transaction( _Connection *connection, const bool readOnly )
+{
+	this->connection = NULL;
+	this->savepointsCreated = 0;
+	if( connection->isInTransaction() )
+		throw QueryException("A transaction is already open on this connection. Use a savepoint to nest one inside it.");
+	connection->sendRawQuery( readOnly ? "START TRANSACTION READ ONLY" : "START TRANSACTION" );
+	this->connection = connection;
+}
+Transaction::Transaction( Transaction &&other ) noexcept
+{
+	this->connection = other.connection;
+	this->savepointsCreated = other.savepointsCreated;
+	other.connection = NULL;
+}
+Transaction &Transaction::operator=( Transaction &&other )
+{
+	if( this != &other )
+	{
+		if( connection )
+			rollback();
+		this->connection = other.connection;
+		this->savepointsCreated = other.savepointsCreated;
+		other.connection = NULL;
+	}
+	return *this;
+}
+//A destructor cannot throw, so a failed rollback is only reported. The server rolls back
+//	on its own when the connection drops, which is the usual reason for it to fail.
+Transaction::~Transaction()
+{
+	if( !connection )
+		return;
+	try {
+		rollback();
+	} catch( Exception &e ) {
+		e.report();
+	}
+}
+void Transaction::run( const std::string &statement )
+{
+	if( !connection )
+		throw QueryException("The transaction has already been committed or rolled back.", NULL, statement.c_str());
+	connection->sendRawQuery( statement );
+}
+//The transaction is over whether or not these succeed, since a failed COMMIT is rolled back.
+void Transaction::commit()
+{
+	_Connection *ending = connection;
+	connection = NULL;
+	if( !ending )
+		throw QueryException("The transaction has already been committed or rolled back.", NULL, "COMMIT");
+	ending->sendRawQuery( "COMMIT" );
+}
+void Transaction::rollback()
 {
-	std::string encodedTimestamp = encodeDate(unixTimestamp);
-	if(encodedTimestamp == "NULL")
+	_Connection *ending = connection;
+	connection = NULL;
+	if( !ending )
+		throw QueryException("The transaction has already been committed or rolled back.", NULL, "ROLLBACK");
+	ending->sendRawQuery( "ROLLBACK" );
+}
+std::string Transaction::quoteName( const std::string &name )
+{
+	std::string quoted = "`";
+	for(size_t i = 0;i < name.size();++i)
 	{
-		return encodedTimestamp;
+		if( name[ i ] == '`' )
+			quoted += '`';
+		quoted += name[ i ];
 	}
-	return std::string("'") + encodedTimestamp + std::string("'");
+	quoted += '`';
+	return quoted;
+}
+std::string Transaction::savepoint()
+{
+	std::string name = "sqlDatabase_savepoint_" + std::to_string( ++savepointsCreated );
+	savepoint( name );
+	return name;
+}
+void Transaction::savepoint( const std::string &name )
+{
+	run( "SAVEPOINT " + quoteName( name ) );
+}
+void Transaction::rollbackTo( const std::string &name )
+{
+	run( "ROLLBACK TO SAVEPOINT " + quoteName( name ) );
+}
+void Transaction::release( const std::string &name )
+{
+	run( "RELEASE SAVEPOINT " + quoteName( name ) );
 }
 
-std::string encodeDate(const time_t unixTimestamp)
+/************* Query Template Member Function Implementations ************/
+
+QueryTemplate::QueryTemplate()
 {
-	struct tm *timeInfo;
-	char buffer[32];
+	this->parametersWritten = 0;
+	this->finished = false;
+}
 
-	if(unixTimestamp == 0)
-		return "NULL";
+QueryTemplate::QueryTemplate( const std::string &text )
+{
+	this->text = text;
+	this->parametersWritten = 0;
+	this->finished = false;
+	parse();
+	//Leave room for a short value at each placeholder, so most uses never grow the buffer.
+	buffer.reserve( text.size() + placeholders.size() * 16 );
+}
 
-	timeInfo = localtime(&unixTimestamp);
-	strftime(buffer, 32, "%Y-%m-%d %H:%M:%S", timeInfo);
+//Find the placeholders, skipping over quoted text and comments.
+void QueryTemplate::parse()
+{
+	for(size_t i = 0;i < text.size();++i)
+	{
+		char c = text[ i ];
+		if( c == '\'' || c == '"' || c == '`' )
+		{
+			for(++i;i < text.size() && text[ i ] != c;++i)
+			{
+				if( text[ i ] == '\\' && c != '`' )
+					++i;
+			}
+		}
+		else if( c == '/' && i + 1 < text.size() && text[ i + 1 ] == '*' )
+		{
+			size_t end = text.find( "*/", i + 2 );
+			i = (end == std::string::npos) ? text.size() : end + 1;
+		}
+		else if( c == '#' || (c == '-' && i + 2 < text.size() && text[ i + 1 ] == '-' && isspace( (unsigned char)text[ i + 2 ] )) )
+		{
+			size_t end = text.find( '\n', i );
+			i = (end == std::string::npos) ? text.size() : end;
+		}
+		else if( c == '?' )
+			placeholders.push_back( i );
+	}
+}
 
-	return std::string(buffer);
+void QueryTemplate::start()
+{
+	buffer.clear();
+	parametersWritten = 0;
+	finished = false;
 }
 
-int encodeBooleanInt(bool boolean)
+//Copy the text up to the next placeholder.
+void QueryTemplate::beginValue()
 {
-	return boolean ? 1 : 0;
+	if( finished )
+		throw QueryException("The query template was finished. Call start() before filling it in again.", NULL, text.c_str());
+	if( parametersWritten >= placeholders.size() )
+		throw QueryException("More values were given than the query template has placeholders.", NULL, text.c_str());
+
+	size_t segmentStart = parametersWritten ? placeholders[ parametersWritten - 1 ] + 1 : 0;
+	buffer.append( text, segmentStart, placeholders[ parametersWritten ] - segmentStart );
+	++parametersWritten;
 }
 
-}//Namespace
+const std::string &QueryTemplate::str()
+{
+	if( finished )
+		return buffer;
+	if( parametersWritten != placeholders.size() )
+		throw QueryException("Not every placeholder of the query template has a value.", NULL, text.c_str());
+
+	size_t segmentStart = placeholders.empty() ? 0 : placeholders.back() + 1;
+	buffer.append( text, segmentStart, std::string::npos );
+	finished = true;
+	return buffer;
+}
+
+void QueryTemplate::putNull()
+{
+	beginValue();
+	buffer += "NULL";
+}
+void QueryTemplate::putString( const char *value, const size_t length )
+{
+	beginValue();
+	appendQuotedString( buffer, value, length );
+}
+void QueryTemplate::putInt( const long long value )
+{
+	beginValue();
+	appendInteger( buffer, value );
+}
+void QueryTemplate::putUnsignedInt( const unsigned long long value )
+{
+	beginValue();
+	appendUnsignedInteger( buffer, value );
+}
+void QueryTemplate::putDouble( const double value )
+{
+	beginValue();
+	appendDouble( buffer, value );
+}
+void QueryTemplate::putBool( const bool value )
+{
+	beginValue();
+	buffer += (value ? '1' : '0');
+}
+void QueryTemplate::putChar( const char value )
+{
+	//A NUL character is written as an empty string, as BatchInsertStatement does.
+	beginValue();
+	appendQuotedString( buffer, &value, value ? 1 : 0 );
+}
+void QueryTemplate::putDate( const time_t value )
+{
+	beginValue();
+	appendQuotedDate( buffer, value );
+}
+
+//The character written after a backslash for each byte that must be escaped, or 0 if the byte is
+//	written as is. This is the same set mysql_real_escape_string() escapes.
+struct EscapeTable
+{
+	char replacements[256];
+	EscapeTable()
+	{
+		memset( replacements, 0, sizeof(replacements) );
+		replacements[ (unsigned char)'\0' ] = '0';
+		replacements[ (unsigned char)'\n' ] = 'n';
+		replacements[ (unsigned char)'\r' ] = 'r';
+		replacements[ (unsigned char)'\\' ] = '\\';
+		replacements[ (unsigned char)'\'' ] = '\'';
+		replacements[ (unsigned char)'"' ] = '"';
+		replacements[ (unsigned char)'\x1a' ] = 'Z';
+	}
+};
+static const char *escapeTable()
+{
+	static const EscapeTable table;
+	return table.replacements;
+}
+
+//Length of the leading run of bytes that need no escaping.
+static size_t safeRunLength( const char *str, const size_t length )
+{
+	size_t position = 0;
+#if defined(__SSE2__)
+	//Test sixteen bytes at a time against every special character.
+	const __m128i nul = _mm_set1_epi8( '\0' );
+	const __m128i newline = _mm_set1_epi8( '\n' );
+	const __m128i carriageReturn = _mm_set1_epi8( '\r' );
+	const __m128i backslash = _mm_set1_epi8( '\\' );
+	const __m128i singleQuote = _mm_set1_epi8( '\'' );
+	const __m128i doubleQuote = _mm_set1_epi8( '"' );
+	const __m128i control = _mm_set1_epi8( '\x1a' );
+	for(;position + 16 <= length;position += 16)
+	{
+		__m128i block = _mm_loadu_si128( (const __m128i*)(str + position) );
+		__m128i special = _mm_or_si128(
+			_mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8(block, nul), _mm_cmpeq_epi8(block, newline) ),
+				_mm_or_si128( _mm_cmpeq_epi8(block, carriageReturn), _mm_cmpeq_epi8(block, backslash) ) ),
+			_mm_or_si128( _mm_or_si128( _mm_cmpeq_epi8(block, singleQuote), _mm_cmpeq_epi8(block, doubleQuote) ),
+				_mm_cmpeq_epi8(block, control) ) );
+		int mask = _mm_movemask_epi8( special );
+		if( mask != 0 )
+			return position + __builtin_ctz( mask );
+	}
+#endif
+	const char *table = escapeTable();
+	while( position < length && table[ (unsigned char)str[ position ] ] == 0 )
+		++position;
+	return position;
+}
+
+void appendEscapedString( std::string &buffer, const char *str, const size_t length )
+{
+	//Every character could need escaping, so size the output once and write into it directly.
+	size_t start = buffer.size();
+	buffer.resize( start + length * 2 );
+	char *out = &buffer[ start ];
+
+	const char *table = escapeTable();
+	size_t position = 0;
+	while( position < length )
+	{
+		size_t run = safeRunLength( str + position, length - position );
+		memcpy( out, str + position, run );
+		out += run;
+		position += run;
+		if( position < length )
+		{
+			*(out++) = '\\';
+			*(out++) = table[ (unsigned char)str[ position++ ] ];
+		}
+	}
+	buffer.resize( out - buffer.data() );
+}
+
+void appendQuotedString( std::string &buffer, const char *str, const size_t length )
+{
+	buffer += '\'';
+	appendEscapedString( buffer, str, length );
+	buffer += '\'';
+}
+
+void appendInteger( std::string &buffer, const long long value )
+{
+	char digits[24];
+	std::to_chars_result result = std::to_chars( digits, digits + sizeof(digits), value );
+	buffer.append( digits, result.ptr - digits );
+}
+
+void appendUnsignedInteger( std::string &buffer, const unsigned long long value )
+{
+	char digits[24];
+	std::to_chars_result result = std::to_chars( digits, digits + sizeof(digits), value );
+	buffer.append( digits, result.ptr - digits );
+}
+
+//Doubles are written with the fewest digits that read back as the same value.
+void appendDouble( std::string &buffer, const double value )
+{
+	char digits[32];
+#if defined(__cpp_lib_to_chars)
+	std::to_chars_result result = std::to_chars( digits, digits + sizeof(digits), value );
+	buffer.append( digits, result.ptr - digits );
+#else
+	int length = snprintf( digits, sizeof(digits), "%.17g", value );
+	buffer.append( digits, length );
+#endif
+}
+
+static void appendDateText( std::string &buffer, const time_t unixTimestamp, const bool quoted )
+{
+	if( unixTimestamp == 0 )
+	{
+		buffer += "NULL";
+		return;
+	}
+	tm timeInfo;
+#ifdef _WIN32
+	localtime_s( &timeInfo, &unixTimestamp );
+#else
+	localtime_r( &unixTimestamp, &timeInfo );
+#endif
+	//Written by hand, as strftime() looks up the locale for every call.
+	const int parts[6] = { timeInfo.tm_year + 1900, timeInfo.tm_mon + 1, timeInfo.tm_mday, timeInfo.tm_hour, timeInfo.tm_min, timeInfo.tm_sec };
+	const char separators[6] = { '-', '-', ' ', ':', ':', 0 };
+	char text[24];
+	size_t length = 0;
+	if( quoted )
+		text[ length++ ] = '\'';
+	length += snprintf( text + length, 5, "%04d", parts[0] % 10000 );
+	text[ length++ ] = separators[0];
+	for(int i = 1;i < 6;++i)
+	{
+		text[ length++ ] = (char)('0' + parts[ i ] / 10);
+		text[ length++ ] = (char)('0' + parts[ i ] % 10);
+		if( separators[ i ] )
+			text[ length++ ] = separators[ i ];
+	}
+	if( quoted )
+		text[ length++ ] = '\'';
+	buffer.append( text, length );
+}
+void appendDate( std::string &buffer, const time_t unixTimestamp )
+{
+	appendDateText( buffer, unixTimestamp, false );
+}
+void appendQuotedDate( std::string &buffer, const time_t unixTimestamp )
+{
+	appendDateText( buffer, unixTimestamp, true );
+}
+
+time_t parseTimestamp( const char *text, const size_t length )
+{
+	//Read year, month, day, hour, minute & second, each separated by one character.
+	int parts[6];
+	const char *end = text + length;
+	int nr_parts = 0;
+	while( nr_parts < 6 && text < end )
+	{
+		if( *text < '0' || *text > '9' )
+			return 0;
+		int value = 0;
+		while( text < end && *text >= '0' && *text <= '9' )
+			value = value * 10 + (*(text++) - '0');
+		parts[ nr_parts++ ] = value;
+		if( text < end ) ++text;//Skip the separator.
+	}
+	if( nr_parts != 6 || (parts[0] == 0 && parts[1] == 0 && parts[2] == 0) )
+		return 0;
+	return makeLocalTimestamp( parts[0], parts[1], parts[2], parts[3], parts[4], parts[5] );
+}
+
+//Days since 1970-01-01 of a date in the proleptic Gregorian calendar.
+static long long daysFromCivil( long long year, const int month, const int day )
+{
+	year -= month <= 2;
+	const long long era = (year >= 0 ? year : year - 399) / 400;
+	const long long yearOfEra = year - era * 400;
+	const long long dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	const long long dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+	return era * 146097 + dayOfEra - 719468;
+}
 
-void insertLetterBeforeLetter(std::string &str, const char letterToFind, const char letterToLead)
+time_t makeLocalTimestamp( const int year, const int month, const int day, const int hour, const int minute, const int second )
 {
-	std::string::size_type pos;
-	for(pos = str.find(letterToFind, 0);pos != std::string::npos;
-		pos = str.find(letterToFind, pos + 1))
+	//Seconds since the epoch if the wall clock time were UTC.
+	long long wallClock = daysFromCivil( year, month, day ) * 86400LL + hour * 3600LL + minute * 60LL + second;
+	long long hourStart = wallClock - (((wallClock % 3600) + 3600) % 3600);
+
+	//Zone offsets only change on the hour, so one mktime() call covers a whole hour of wall clock time.
+	struct CachedOffset
+	{
+		long long hourStart;
+		long long offset;
+		bool valid;
+	};
+	static thread_local CachedOffset cache[ 64 ] = {};
+	CachedOffset &entry = cache[ (unsigned long long)(hourStart / 3600) % 64 ];
+
+	if( !entry.valid || entry.hourStart != hourStart )
 	{
-		str.insert(pos, 1, letterToLead);
-		++pos;
+		long long secondsOfDay = hourStart - daysFromCivil( year, month, day ) * 86400LL;
+		tm t;
+		memset(&t, 0, sizeof(tm));
+		t.tm_isdst = -1;
+		t.tm_year = year - 1900;
+		t.tm_mon = month - 1;
+		t.tm_mday = day;
+		t.tm_hour = (int)(secondsOfDay / 3600);
+		entry.offset = hourStart - (long long)mktime(&t);
+		entry.hourStart = hourStart;
+		entry.valid = true;
 	}
+	return (time_t)(wallClock - entry.offset);
+}
+
+std::string escapeString(const std::string &str)
+{
+	std::string escapedString;
+	appendEscapedString( escapedString, str.data(), str.size() );
+	return escapedString;
+}
+
+std::string escapeQuoteString(const std::string &str)
+{
+	std::string quotedString;
+	appendQuotedString( quotedString, str.data(), str.size() );
+	return quotedString;
 }
+
+std::string encodeQuoteDate(const time_t unixTimestamp)
+{
+	std::string encodedTimestamp;
+	appendQuotedDate( encodedTimestamp, unixTimestamp );
+	return encodedTimestamp;
+}
+
+std::string encodeDate(const time_t unixTimestamp)
+{
+	std::string encodedTimestamp;
+	appendDate( encodedTimestamp, unixTimestamp );
+	return encodedTimestamp;
+}
+
+int encodeBooleanInt(bool boolean)
+{
+	return boolean ? 1 : 0;
+}
+
+}//Namespace
+
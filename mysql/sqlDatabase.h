@@ -13,6 +13,7 @@ Author: Michael Mason - mikemason930@gmail.com (C) 01-26-2007
 #include <string>
 #include <map>
 #include <list>
+#include <vector>
 #include <mysql/mysql.h>
 #include <iostream>
 #include <sstream>
@@ -20,6 +21,29 @@ Author: Michael Mason - mikemason930@gmail.com (C) 01-26-2007
 #include <memory>
 #include <cstring>
 #include <optional>
+#include <string_view>
+#include <charconv>
+#include <climits>
+#include <type_traits>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <iterator>
+#include <tuple>
+#include <utility>
+#include <deque>
+#include <exception>
+#include <array>
+#include <algorithm>
+
+//The MariaDB client library provides a non-blocking API, which _AsyncQuery is built on.
+#if defined(MYSQL_WAIT_READ)
+#define SQL_DATABASE_ASYNC
+#endif
 
 namespace sql
 {
@@ -28,20 +52,312 @@ class _Connection;
 class _Query;
 class _Context;
 class Row;
+class MaterializedRow;
+class RowView;
+class QueryIterator;
+class Transaction;
+struct ConnectionOptions;
+template< typename Record, typename Member > struct FieldMapping;
+template< typename T > struct ColumnVector;
+class _PreparedStatement;
+class _ConnectionPool;
+class _AsyncQuery;
+class _WriteBehindQueue;
+class _InsertPipeline;
+class _QueryCache;
+class _MaterializedResult;
+class _QueryProfiler;
 typedef std::shared_ptr< _Query > Query;
+typedef std::shared_ptr< const _Query > ConstQuery;
 typedef std::shared_ptr< _Context > Context;
 typedef std::shared_ptr< _Connection > Connection;
+typedef std::shared_ptr< _PreparedStatement > PreparedStatement;
+typedef std::shared_ptr< _ConnectionPool > ConnectionPool;
+typedef std::shared_ptr< _AsyncQuery > AsyncQuery;
+typedef std::shared_ptr< _WriteBehindQueue > WriteBehindQueue;
+typedef std::shared_ptr< _InsertPipeline > InsertPipeline;
+typedef std::shared_ptr< _QueryCache > QueryCache;
+typedef std::shared_ptr< _MaterializedResult > MaterializedResult;
+typedef std::shared_ptr< _QueryProfiler > QueryProfiler;
 
 std::string escapeString( const std::string &str );
 std::string escapeQuoteString( const std::string &str );
 Context createContext( const std::string &Host, const std::string &User, const std::string &Password, const std::string &DatabaseName );
+Context createContext( const std::string &host, const std::string &user, const std::string &password, const std::string &databaseName, const ConnectionOptions &options );
 std::string encodeDate(const time_t unix_timestamp);
 std::string encodeQuoteDate(const time_t unix_timestamp);
 int encodeBooleanInt(bool boolean);
 
-//Define an Row as an std::map . The index is the field name,
-//	the resulting element is the data from the row.
-typedef std::map< std::string, int > sqlFieldSet;
+//Append SQL values straight onto the end of a buffer, without temporary strings.
+//	These are shared by every statement builder that writes values into a query.
+void appendEscapedString( std::string &buffer, const char *str, const size_t length );
+void appendQuotedString( std::string &buffer, const char *str, const size_t length );
+void appendInteger( std::string &buffer, const long long value );
+void appendUnsignedInteger( std::string &buffer, const unsigned long long value );
+void appendDouble( std::string &buffer, const double value );
+//Local date and time as "YYYY-MM-DD HH:MM:SS", or NULL for a zero timestamp.
+void appendDate( std::string &buffer, const time_t unixTimestamp );
+void appendQuotedDate( std::string &buffer, const time_t unixTimestamp );
+
+//A counter that many threads can add to without contending for one cache line. Each thread adds to
+//	one of several padded shards, and reading sums them, so reads are slower than writes.
+class ShardedCounter
+{
+private:
+	static const size_t shardCount = 16;
+	struct alignas(64) Shard
+	{
+		std::atomic< long long > value;
+	};
+	Shard shards[ shardCount ];
+	static inline std::atomic< size_t > nextShard{ 0 };
+
+	static size_t shardIndex()
+	{
+		//Threads take shards in turn the first time they count anything.
+		static thread_local size_t index = nextShard.fetch_add( 1, std::memory_order_relaxed ) % shardCount;
+		return index;
+	}
+public:
+	void add( const long long amount ) { shards[ shardIndex() ].value.fetch_add( amount, std::memory_order_relaxed ); }
+	void operator++() { add( 1 ); }
+	long long get() const
+	{
+		long long total = 0;
+		for(size_t i = 0;i < shardCount;++i)
+			total += shards[ i ].value.load( std::memory_order_relaxed );
+		return total;
+	}
+};
+
+//What a connection has done since it was opened or its metrics were last reset.
+struct ConnectionMetrics
+{
+	//Bucket b counts queries that took under 2^b microseconds, but at least 2^(b-1). The last bucket takes the rest.
+	static const int latencyBuckets = 32;
+
+	unsigned long long queries;
+	unsigned long long failedQueries;
+	unsigned long long bytesSent;	//Query text sent.
+	unsigned long long bytesReceived;	//Cell data of the rows read.
+	unsigned long long rowsFetched;
+	unsigned long long totalLatencyMicroseconds;
+	unsigned long long latencyHistogram[ latencyBuckets ];
+
+	//An upper bound, in microseconds, on the latency of the given fraction of queries, such as 0.99.
+	unsigned long long getLatencyPercentile( const double fraction ) const;
+	double getAverageLatencyMicroseconds() const { return queries ? (double)totalLatencyMicroseconds / queries : 0.0; }
+};
+
+//How long each step of a statement took. Send is writing it to the server, execute is waiting
+//	for the server to run it and reply, and fetch is reading back its result.
+struct QueryTiming
+{
+	std::chrono::microseconds send;
+	std::chrono::microseconds execute;
+	std::chrono::microseconds fetch;
+	bool failed;
+
+	QueryTiming() : send(0), execute(0), fetch(0), failed(false) {}
+	std::chrono::microseconds total() const { return send + execute + fetch; }
+};
+
+//How connections are opened, applied through mysql_options() by _Connection::connect().
+//	The defaults leave everything to the client library, as connecting without options does.
+struct ConnectionOptions
+{
+	enum Compression { NoCompression, Zlib, Zstd };
+	enum SslMode { SslPreferred, SslRequired, SslVerifyIdentity };
+
+	unsigned int port;	//Zero for the default port.
+	std::string unixSocket;	//Connect through this socket, or named pipe on Windows, when the host is "localhost".
+	unsigned long clientFlags;	//CLIENT_* flags, added to CLIENT_MULTI_STATEMENTS, which is always set.
+
+	//Compressing the protocol trades CPU for bandwidth, which pays off on large results over slow
+	//	links. Where the client library has no zstd (MariaDB Connector/C, or MySQL before 8.0.18),
+	//	Zstd falls back to zlib. A zstdLevel of zero uses the library's default level.
+	Compression compression;
+	unsigned int zstdLevel;
+
+	//Zero for the client library's defaults. The read and write timeouts bound each network
+	//	wait, and the client library retries reads up to three times within the read timeout.
+	std::chrono::seconds connectTimeout;
+	std::chrono::seconds readTimeout;
+	std::chrono::seconds writeTimeout;
+
+	SslMode sslMode;
+	std::string sslKey;
+	std::string sslCert;
+	std::string sslCa;
+	std::string sslCaPath;
+	std::string sslCipher;
+
+	std::string characterSet;	//Such as "utf8mb4". Empty for the client library's default.
+	std::vector< std::string > initCommands;	//Run, in order, after every connect and reconnect.
+
+	ConnectionOptions() : port(0), clientFlags(0), compression(NoCompression), zstdLevel(0),
+		connectTimeout(0), readTimeout(0), writeTimeout(0), sslMode(SslPreferred) {}
+};
+
+//How a pipelined BatchInsertStatement sends its batches on worker connections.
+struct PipelineOptions
+{
+	unsigned int connections;	//Worker connections sending batches at the same time. Only one is used when ordered.
+	unsigned int maxQueuedBatches;	//Built batches waiting for a worker before flushing blocks the caller.
+	bool ordered;	//Run the batches one at a time, in the order they were built.
+	//Send the batches in one transaction, committed by finish() if no batch failed. This needs a
+	//	single worker, ordered or with one connection, as separate workers' COMMITs could not
+	//	succeed or fail together. Other options throw a QueryException.
+	bool transaction;
+
+	PipelineOptions() : connections(1), maxQueuedBatches(2), ordered(true), transaction(false) {}
+};
+
+//Told about every statement run on the connections it is attached to, on the thread that ran it.
+//	A profiler shared by connections on several threads must be thread-safe.
+class _QueryProfiler
+{
+public:
+	virtual ~_QueryProfiler() {}
+	virtual void record( std::string_view queryBuffer, const QueryTiming &timing ) = 0;
+};
+
+//A profiler that totals statements by fingerprint: the statement with its literals replaced by '?',
+//	so that the same query with different values is counted together. Statements slower than
+//	the threshold are passed to the slow query log, or written to stdout if there is none.
+class _StatementProfiler : public _QueryProfiler
+{
+public:
+	struct Statistics
+	{
+		std::string fingerprint;
+		unsigned long long count;
+		unsigned long long failures;
+		std::chrono::microseconds send;
+		std::chrono::microseconds execute;
+		std::chrono::microseconds fetch;
+		std::chrono::microseconds slowest;
+
+		std::chrono::microseconds total() const { return send + execute + fetch; }
+	};
+private:
+	std::mutex mutex;
+	std::map< std::string, Statistics > statistics;
+	std::chrono::microseconds slowThreshold;	//Zero to log nothing.
+	std::function< void( std::string_view, const QueryTiming & ) > slowQueryLog;
+public:
+	_StatementProfiler( const std::chrono::microseconds slowThreshold, std::function< void( std::string_view, const QueryTiming & ) > slowQueryLog = nullptr );
+
+	void record( std::string_view queryBuffer, const QueryTiming &timing ) override;
+
+	static std::string fingerprint( std::string_view queryBuffer );
+
+	//Totals for each fingerprint, the most total time first.
+	std::vector< Statistics > getStatistics();
+	void reset();
+};
+typedef std::shared_ptr< _StatementProfiler > StatementProfiler;
+
+//The field names of a result, by column index. Names are looked up through an
+//	open-addressed hash table that is built once, when the result's fields are read.
+class sqlFieldSet
+{
+private:
+	std::vector< std::string > names;	//Field names by column index.
+	std::vector< int > slots;		//Column index stored at each hash slot, or -1 if the slot is empty.
+
+	//FNV-1a. Field names are short, so this is cheaper than the comparisons it saves.
+	static size_t hash( const std::string &name )
+	{
+		size_t value = (size_t)14695981039346656037ULL;
+		for(size_t i = 0;i < name.size();++i)
+		{
+			value ^= (unsigned char)name[ i ];
+			value *= (size_t)1099511628211ULL;
+		}
+		return value;
+	}
+	void insert( const int index );
+public:
+	void add( const std::string &name );
+	void clear();
+	size_t size() const { return names.size(); }
+
+	//Column index of the field, or -1 if the result has no field by that name.
+	//	When several fields share a name, the last one is found.
+	int find( const std::string &name ) const
+	{
+		if( slots.empty() )
+			return -1;
+		size_t mask = slots.size() - 1;
+		for(size_t slot = hash( name ) & mask;slots[ slot ] != -1;slot = (slot + 1) & mask)
+		{
+			if( names[ slots[ slot ] ] == name )
+				return slots[ slot ];
+		}
+		return -1;
+	}
+	const std::string &getName( const int index ) const { return names[ index ]; }
+};
+
+//A field resolved by name once per result set. Row getters take it in place of the
+//	field name, so loops over rows only do integer access.
+class Column
+{
+private:
+	int index;
+public:
+	Column() { index = -1; }
+	explicit Column( const int index ) { this->index = index; }
+	operator int() const { return index; }
+	int getIndex() const { return index; }
+};
+
+//Parsers for the text the server sends for each column. They read MySQL's fixed formats
+//	directly, without locale lookups or allocation, and return 0 for text that does not parse.
+//	Integers are always read in base 10.
+template< typename T >
+T parseInteger( const char *text, const size_t length )
+{
+	const char *end = text + length;
+	while( text < end && *text == ' ' )
+		++text;
+	//Negative text read into an unsigned type wraps, the same as strtoul().
+	if( std::is_signed< T >::value || (text < end && *text == '-') )
+	{
+		long long value = 0;
+		std::from_chars_result result = std::from_chars( text, end, value );
+		if( result.ec == std::errc::result_out_of_range )
+			value = (*text == '-') ? LLONG_MIN : LLONG_MAX;
+		return (T)value;
+	}
+	unsigned long long value = 0;
+	std::from_chars_result result = std::from_chars( text, end, value );
+	if( result.ec == std::errc::result_out_of_range )
+		value = ULLONG_MAX;
+	return (T)value;
+}
+
+inline double parseDouble( const char *text, const size_t length )
+{
+#if defined(__cpp_lib_to_chars)
+	double value = 0;
+	std::from_chars( text, text + length, value );
+	return value;
+#else
+	//Older standard libraries have no floating point from_chars().
+	(void)length;
+	return strtod( text, nullptr );
+#endif
+}
+
+//Parse a DATETIME or TIMESTAMP value ("YYYY-MM-DD HH:MM:SS", optionally with fractional seconds)
+//	in local time. Zero dates and text without all six parts parse as 0.
+time_t parseTimestamp( const char *text, const size_t length );
+
+//Convert a local calendar time to a unix timestamp without calling mktime() for every value.
+//	The local UTC offset is looked up once per hour of wall clock time and cached per thread.
+time_t makeLocalTimestamp( const int year, const int month, const int day, const int hour, const int minute, const int second );
 
 struct Exception
 {
@@ -70,11 +386,14 @@ struct QueryException:Exception
 			std::stringstream buff;
 			buff << err;
 			this->message += (std::string(" (#")+buff.str()+std::string(")")) + std::string("\n");
-			if( queryBuffer ) {
-				this->message += std::string("Original query: ") + std::string(queryBuffer);
-			}
 		} else {
 			err = (-1);
+			if( queryBuffer )
+				this->message += std::string("\n");
+		}
+		//Given even without a connection, so that errors raised by the library name their statement.
+		if( queryBuffer ) {
+			this->message += std::string("Original query: ") + std::string(queryBuffer);
 		}
 	}
 	virtual void report() { std::cout << "Query exception: " << message << std::endl; }
@@ -96,26 +415,56 @@ struct ConnectionException:Exception
 class BatchInsertStatement
 {
 	unsigned int numberOfInserts, insertsPerFlush, numberOfFieldsLoaded;
+	WriteBehindQueue writeBehindQueue;	//When set, batches are queued here instead of sent on the connection.
+	InsertPipeline pipeline;	//When set, batches are sent by its worker connections instead.
 	std::string tableName;
-	std::string header;
-	std::stringstream sql;
+	std::string sql;	//The whole statement, built in place. Reused between flushes.
+	size_t headerLength;	//Length of the "INSERT INTO ...VALUES" prefix at the start of sql.
+	size_t entryStart;	//Offset in sql where the entry being built starts.
+	size_t maxBytesPerFlush;	//Flush before the statement grows past this many bytes. Zero for no limit.
 	bool firstFieldThisEntry;
 	bool firstField;
 	bool hasStarted;
 	Connection connection;
 
 	void init( Connection connection, const std::string &tableName, const unsigned int insertsPerFlush, bool insertIgnore );
+	void beginFieldValue();
+	void sendBatch( const size_t length );
 public:
 
 	BatchInsertStatement();
 	BatchInsertStatement( Connection connection, const std::string &tableName, const unsigned int insertsPerFlush );
-	BatchInsertStatement( _Connection *connection, const std::string &tableName, const unsigned int insertsPerFlush );
 	BatchInsertStatement( Connection connection, const std::string &tableName, const unsigned int insertsPerFlush, bool insertIgnore );
+	//These take ownership of the connection and delete it with the statement, so it must not be
+	//	owned anywhere else. A connection already held by a Connection must use the overloads above.
+	[[deprecated("Pass a Connection instead")]]
+	BatchInsertStatement( _Connection *connection, const std::string &tableName, const unsigned int insertsPerFlush );
+	[[deprecated("Pass a Connection instead")]]
 	BatchInsertStatement( _Connection *connection, const std::string &tableName, const unsigned int insertsPerFlush, bool insertIgnore );
+	BatchInsertStatement( WriteBehindQueue queue, const std::string &tableName, const unsigned int insertsPerFlush, bool insertIgnore = false );
+
+	//Pipelined statements hand each batch to worker connections and carry on building the next
+	//	one while it is sent. The workers use connections checked out of the pool, or the one
+	//	connection given, which must not be used elsewhere until finish(). A batch that fails stops
+	//	the rest from being sent, and its exception is thrown from the next flush or from finish().
+	BatchInsertStatement( ConnectionPool pool, const std::string &tableName, const unsigned int insertsPerFlush,
+		const PipelineOptions &options, bool insertIgnore = false );
+	BatchInsertStatement( Connection worker, const std::string &tableName, const unsigned int insertsPerFlush,
+		const PipelineOptions &options, bool insertIgnore = false );
 
 	void flush();
 	void finish();
 
+	//A batch is flushed once it holds insertsPerFlush entries, or once it would grow past
+	//	maxBytesPerFlush bytes. The byte limit starts just under the server's max_allowed_packet.
+	void setInsertsPerFlush( const unsigned int insertsPerFlush ) { this->insertsPerFlush = insertsPerFlush; }
+	void setMaxBytesPerFlush( const size_t maxBytesPerFlush ) { this->maxBytesPerFlush = maxBytesPerFlush; }
+	unsigned int getInsertsPerFlush() const { return insertsPerFlush; }
+	size_t getMaxBytesPerFlush() const { return maxBytesPerFlush; }
+	//Entries and bytes built up since the last flush.
+	unsigned int getPendingInserts() const { return numberOfInserts; }
+	size_t getPendingBytes() const { return sql.size(); }
+
 	void addField( const std::string &field );
 
 	void start();
@@ -125,113 +474,314 @@ public:
 
 	void addFieldValue( const std::string &value );
 	void putString( const std::string &value );
+	//A null pointer is written as an empty string, as it is by BulkLoader. Use putNull() for NULL.
+	void putString( const char *value );
+	void putInt( const int value );
+	void putLong( const long long value );
+	void putChar( char value );
+	void putDate( const time_t value );
+	void putBool( bool value );
+	void putDouble( double value );
+};
+
+//Loads rows with LOAD DATA LOCAL INFILE, through the same interface as BatchInsertStatement.
+//	Rows are written as tab separated text into a buffer that the client library reads from
+//	memory, in place of a file, so nothing touches the disk and no SQL is built per row.
+//	Each time the buffer reaches bytesPerFlush it is sent as one LOAD DATA statement.
+//	The connection must allow local infile, see _Connection::setLocalInfile().
+//
+//	The server reports bad values and duplicate keys in a local load as warnings rather than
+//	errors, so check getWarningCount() after finish(). With replace set, rows that collide
+//	with an existing key replace it, and otherwise they are skipped.
+class BulkLoader
+{
+	Connection connection;
+	std::string tableName;
+	std::string fields;	//The column list, comma separated.
+	std::string statement;	//The LOAD DATA statement, built by start().
+	std::string buffer;	//Rows not yet sent, as tab separated text.
+	size_t bytesPerFlush;
+	bool replace;
+	bool firstFieldThisEntry;
+	bool hasStarted;
+	unsigned long long rowsLoaded;
+	unsigned int warningCount;
+
+	void beginFieldValue();
+	void appendEscaped( const char *value, const size_t length );
+public:
+	//The file name the LOAD DATA statement asks for. It is not a real file.
+	static constexpr const char *fileName = "sqlDatabase-bulk-load";
+
+	BulkLoader( Connection connection, const std::string &tableName, bool replace = false );
+
+	void setBytesPerFlush( const size_t bytesPerFlush ) { this->bytesPerFlush = bytesPerFlush; }
+	size_t getBytesPerFlush() const { return bytesPerFlush; }
+
+	void addField( const std::string &field );
+	void start();
+
+	void beginEntry();
+	void endEntry();
+
+	void putNull();
+	void putString( const std::string &value );
+	//A null pointer is written as an empty string, as it is by BatchInsertStatement. Use putNull() for NULL.
 	void putString( const char *value );
+	void putString( const char *value, const size_t length );
 	void putInt( const int value );
 	void putLong( const long long value );
+	void putUnsignedLong( const unsigned long long value );
 	void putChar( char value );
+	void putDate( const time_t value );
 	void putBool( bool value );
 	void putDouble( double value );
+
+	void flush();
+	void finish();
+
+	//Rows the server took in, and the warnings it raised, over every flush so far.
+	unsigned long long getRowsLoaded() const { return rowsLoaded; }
+	unsigned int getWarningCount() const { return warningCount; }
+	size_t getPendingBytes() const { return buffer.size(); }
 };
 
-class _Context
+class _Context : public std::enable_shared_from_this< _Context >
 {
 	std::string user;
 	std::string host;
 	std::string password;
 	std::string databaseName;
-	unsigned int port;
-	int flags;
+	ConnectionOptions options;
+	ConnectionPool connectionPool;
+	WriteBehindQueue writeBehindQueue;
+	QueryCache queryCache;
+	QueryProfiler queryProfiler;
+	bool localInfile;
 public:
 	_Context( const std::string &host, const std::string &user, const std::string &password, const std::string &databaseName );
 	_Context( const std::string &host, const std::string &user, const std::string &password, const std::string &databaseName, const int port );
 	_Context( const std::string &host, const std::string &user, const std::string &password, const std::string &databaseName, const int port, const int flags );
+	_Context( const std::string &host, const std::string &user, const std::string &password, const std::string &databaseName, const ConnectionOptions &options );
+
+	//Connections created from the context afterwards are opened with these options.
+	void setConnectionOptions( const ConnectionOptions &options ) { this->options = options; }
+	const ConnectionOptions &getConnectionOptions() { return options; }
 
 	Connection createConnection();
+
+	//Create the context's connection pool, replacing any previous one. The context must be owned
+	//	by a Context (as returned by createContext()) so the pool can open connections from it.
+	ConnectionPool createConnectionPool( const unsigned int minSize, const unsigned int maxSize );
+	ConnectionPool getConnectionPool() { return connectionPool; }
+
+	//Create the context's write-behind queue on a dedicated connection, replacing any previous one.
+	WriteBehindQueue createWriteBehindQueue( const size_t capacity, std::function< void( const std::string &, QueryException & ) > errorCallback = nullptr );
+	WriteBehindQueue getWriteBehindQueue() { return writeBehindQueue; }
+
+	//Connections created from the context afterwards share this result cache.
+	void setQueryCache( QueryCache queryCache ) { this->queryCache = queryCache; }
+	QueryCache getQueryCache() { return queryCache; }
+
+	//Connections created from the context afterwards report their statements to this profiler.
+	void setQueryProfiler( QueryProfiler queryProfiler ) { this->queryProfiler = queryProfiler; }
+	QueryProfiler getQueryProfiler() { return queryProfiler; }
+
+	//Connections created from the context afterwards allow LOAD DATA LOCAL INFILE, for BulkLoader.
+	void setLocalInfile( const bool enabled ) { this->localInfile = enabled; }
+	bool getLocalInfile() { return localInfile; }
 };
 
-class _Query
+class _Query : public std::enable_shared_from_this< _Query >
 {
 private:
 	_Connection* server;
 	MYSQL_RES* resultSet;	//Current query result
 
 	sqlFieldSet			fields;
-	std::list< MYSQL_ROW > rows;
-	std::list< MYSQL_ROW >::iterator rowPosition;
+	std::vector< MYSQL_ROW > rows;	//Sized once from mysql_num_rows(), in result order.
+	std::vector< unsigned long > lengths;	//Byte length of every cell, numFields() per row, from mysql_fetch_lengths().
+	size_t rowPosition;		//Index of the next row returned by getRow().
 
 	std::string request;
-	std::weak_ptr< _Query > sPtr;
+
+	//Streaming queries read rows lazily through mysql_use_result(). Only one row is
+	//	held at a time, so rows are valid until the next fetch from the stream.
+	bool streaming;
+	bool streamFinished;
+	bool hasPendingRow;
+	MYSQL_ROW pendingRow;
+	std::vector< unsigned long > pendingLengths;
+	unsigned int rowsStreamed;
 	
 	MYSQL_RES* getResultSet();
 
-	static int numberOfAllocations;
-	static int numberOfDeallocations;
+	static ShardedCounter numberOfAllocations;
+	static ShardedCounter numberOfDeallocations;
 
 	friend class _Connection;
+	friend class _AsyncQuery;
+	friend class _QueryCache;
+	friend class RowView;
 
 	void setResultSet( MYSQL_RES* Result );
 	void addRow( MYSQL_ROW NewRow );
+	const unsigned long *getRowLengths( const size_t index ) const { return lengths.data() + index * fields.size(); }
 	void setupFields();
 	void clearResultSet();
+	bool fetchStreamRow();
+	void finishStream();
+	void loadResult();
 public:
 	_Query();
-	_Query( const std::string &request, _Connection* connection );
+	_Query( std::string request, _Connection* connection );
 	~_Query();
 
 	static int getNumberOfAllocations();
 	static int getNumberOfDeallocations();
 	static int getRemainder();
 
-	unsigned int numRows();
-	unsigned int numFields();
+	//Only the const members may be used on a ConstQuery, such as a result shared through a QueryCache.
+	//Number of data entries(rows) returned by the sql query.
+	//For a streaming query this is the number of rows read so far.
+	unsigned int numRows() const { return streaming ? rowsStreamed : (unsigned int)rows.size(); }
+	unsigned int numFields() const { return (unsigned int)fields.size(); }
 	Query send();
 	void resetRowQueue();
 	void reverseRows();
-	void skipRow();
-	bool hasNextRow();
-	int getIndexByField( const std::string &Field );
+	//A bit redundant, but more efficient than grabbing a row iterate when un-needed.
+	void skipRow()
+	{
+		if( streaming )
+		{
+			if( fetchStreamRow() ) hasPendingRow = false;
+			return;
+		}
+		if( rowPosition < rows.size() ) ++rowPosition;//Iterate only if not at the end of the list.
+	}
+	//Is there another row in the 'queue'?
+	bool hasNextRow() { return streaming ? fetchStreamRow() : rowPosition < rows.size(); }
+	//Grab the numerical index for a field.
+	int getIndexByField( const std::string &field ) const
+	{
+		int index = fields.find( field );
+		if( index < 0 )
+			throw FieldException("The result has no field named '" + field + "'.");
+		return index;
+	}
+	bool hasField( const std::string &field ) const { return fields.find( field ) >= 0; }
+	Column getColumn( const std::string &field ) const { return Column( getIndexByField(field) ); }
 	Row getRow();
+	Row getRow( const size_t index ) const;
 	Row peekRow();
-	std::string getFieldByIndex( const int index );
-	std::string getQueryBuffer() { return request; }
-	Query getSharedPtr() { return Query( this ); }
+	void seekRow( const size_t index );
+	size_t getRowPosition() const { return rowPosition; }
+	std::string getFieldByIndex( const int index ) const;
+	std::string getQueryBuffer() const { return request; }
+	bool isStreaming() const { return streaming; }
+	void closeStream();
+
+	//Copy a buffered result into a MaterializedResult that no longer needs this query, so the
+	//	query, and the client library's result with it, can be released straight away.
+	MaterializedResult materialize() const;
+
+	//Iterate over a buffered result, as in: for( sql::RowView row : *query )
+	//	The views read the result in place, so they are only valid while the query is.
+	QueryIterator begin() const;
+	QueryIterator end() const;
+
+	//Read every row into a std::tuple, one element per column in column order, such as
+	//	query->as< std::tuple< int, std::string, sql::Timestamp > >()
+	//	Each element is parsed by the FieldReader for its type.
+	template< typename Tuple >
+	std::vector< Tuple > as() const;
+
+	//Read every row into a Record, assigning the named columns to the given members, such as
+	//	query->as< Player >( sql::field("id", &Player::id), sql::field("name", &Player::name) )
+	//	Column names are resolved once, before the first row is read.
+	template< typename Record, typename... Members >
+	std::vector< Record > as( const FieldMapping< Record, Members >&... mappings ) const;
+
+	//Read whole columns of a buffered result into typed vectors in one pass over the rows, such as
+	//	auto [ids, scores] = query->extractColumns< long long, double >( { query->getColumn("id"), query->getColumn("score") } );
+	//	With more than one thread the rows are split into ranges, each read by its own thread.
+	//	Zero threads uses one per hardware thread. Small results are read on the calling thread.
+	template< typename... Types >
+	std::tuple< ColumnVector< Types >... > extractColumns( const std::array< Column, sizeof...(Types) > &columns, const unsigned int threads = 1 ) const;
+	template< typename T >
+	ColumnVector< T > extractColumn( const Column column, const unsigned int threads = 1 ) const;
+	template< typename T >
+	ColumnVector< T > extractColumn( const std::string &field, const unsigned int threads = 1 ) const { return extractColumn< T >( getColumn(field), threads ); }
+	//A query made with new and not yet owned by a Query is owned by the one returned, as send() does.
+	Query getSharedPtr()
+	{
+		Query query = weak_from_this().lock();
+		return query ? query : Query( this );
+	}
 };
 
 class Row
 {
 private:
 	MYSQL_ROW row;
-	std::shared_ptr<_Query> query;
-	static int numberOfAllocations;
-	static int numberOfDeallocations;
+	const unsigned long *lengths;	//Cell lengths captured when the row was fetched. Owned by the query.
+	std::shared_ptr<const _Query> query;
+	static ShardedCounter numberOfAllocations;
+	static ShardedCounter numberOfDeallocations;
 public:
 	static int getNumberOfAllocations()
 	{
-		return numberOfAllocations;
+		return (int)numberOfAllocations.get();
 	}
 	static int getNumberOfDeallocations()
 	{
-		return numberOfDeallocations;
+		return (int)numberOfDeallocations.get();
 	}
 	static int getRemainder()
 	{
-		return numberOfAllocations-numberOfDeallocations;
+		return (int)(numberOfAllocations.get() - numberOfDeallocations.get());
 	}
 	Row() 
 	{
 		++numberOfAllocations;
+		this->row = NULL;
+		this->lengths = NULL;
 	}
 	Row( const Row &original )
 	{
 		++numberOfAllocations;
 		this->row = original.row;
+		this->lengths = original.lengths;
 		this->query = original.query;
 	}
-	Row( std::weak_ptr<_Query> query, MYSQL_ROW row )
+	//Moving takes over the query reference without touching its count.
+	Row( Row &&original ) noexcept
 	{
 		++numberOfAllocations;
-		this->query = query.lock();
+		this->row = original.row;
+		this->lengths = original.lengths;
+		this->query = std::move( original.query );
+	}
+	Row( std::shared_ptr<const _Query> query, MYSQL_ROW row, const unsigned long *lengths = NULL )
+	{
+		++numberOfAllocations;
+		this->query = std::move( query );
 		this->row = row;
+		this->lengths = lengths;
+	}
+	Row &operator=( const Row &original )
+	{
+		this->row = original.row;
+		this->lengths = original.lengths;
+		this->query = original.query;
+		return *this;
+	}
+	Row &operator=( Row &&original ) noexcept
+	{
+		this->row = original.row;
+		this->lengths = original.lengths;
+		this->query = std::move( original.query );
+		return *this;
 	}
 	~Row()
 	{
@@ -251,12 +801,23 @@ public:
 
 	std::string operator [] ( const int fieldIndex ) const
 	{
-		return row[ fieldIndex ];
+		return getString( fieldIndex );
 	}
 	std::string operator [] ( const std::string &fieldName ) const
 	{
-		int index = query->getIndexByField( fieldName );
-		return (row[ index ] ? row[ index ] : (""));
+		return getString( getIndexByField( fieldName ) );
+	}
+
+	//Length in bytes of the field's value, which may contain embedded NUL characters.
+	size_t getLength( const int i ) const
+	{
+		if( row[i] == nullptr )
+			return 0;
+		return lengths ? lengths[i] : strlen(row[i]);
+	}
+	size_t getLength( const std::string &field ) const
+	{
+		return getLength( getIndexByField(field) );
 	}
 	int getIndexByField( const std::string &fieldName ) const
 	{
@@ -276,7 +837,7 @@ public:
 	}
 	int getInt( const int i ) const
 	{
-		return row[i] == nullptr ? 0 : strtol(row[i], nullptr, 0);
+		return row[i] == nullptr ? 0 : parseInteger<int>(row[i], getLength(i));
 	}
 
 	std::optional<int> getNullableInt(const std::string &field ) const
@@ -296,12 +857,12 @@ public:
 	}
 	unsigned int getUnsignedInt( const int i ) const
 	{
-		return row[i] == nullptr ? 0 : strtoul(row[i], nullptr, 0);
+		return row[i] == nullptr ? 0 : parseInteger<unsigned int>(row[i], getLength(i));
 	}
 
 	std::optional<unsigned int> getNullableUnsignedInt(const std::string &field ) const
 	{
-		return getNullableInt(getIndexByField(field));
+		return getNullableUnsignedInt(getIndexByField(field));
 	}
 
 	std::optional<unsigned int> getNullableUnsignedInt( const int i ) const
@@ -316,7 +877,7 @@ public:
 	}
 	short getShort( const int i ) const
 	{
-		return row[i] == nullptr ? 0 : (short)strtol(row[i], nullptr, 0);
+		return row[i] == nullptr ? 0 : parseInteger<short>(row[i], getLength(i));
 	}
 
 	std::optional<short> getNullableShort(const std::string &field ) const
@@ -336,7 +897,7 @@ public:
 	}
 	unsigned short getUnsignedShort( const int i ) const
 	{
-		return row[i] == nullptr ? 0 : (unsigned short)strtoul(row[i], nullptr, 0);
+		return row[i] == nullptr ? 0 : parseInteger<unsigned short>(row[i], getLength(i));
 	}
 
 	std::optional<unsigned short> getNullableUnsignedShort(const std::string &field ) const
@@ -366,7 +927,7 @@ public:
 
 	std::optional<char> getNullableChar( const int i ) const
 	{
-		return row[i] == nullptr ? getChar(i) : std::optional<char>();
+		return row[i] == nullptr ? std::optional<char>() : getChar(i);
 	}
 
 	// Signed long long retrieval
@@ -378,7 +939,7 @@ public:
 	{
 		if(row[i] == NULL)
 			return 0;
-		return strtoll(row[i], nullptr, 0);
+		return parseInteger<long long>(row[i], getLength(i));
 	}
 
 	std::optional<long long> getNullableLongLong( const std::string &field ) const
@@ -389,7 +950,7 @@ public:
 	{
 		if(row[i] == NULL)
 			return std::optional<long long>();
-		return std::optional<long long>(strtoll(row[i], nullptr, 0));
+		return std::optional<long long>(getLongLong(i));
 	}
 
 	// Unsigned long long retrieval
@@ -401,7 +962,7 @@ public:
 	{
 		if(row[i] == NULL)
 			return 0;
-		return strtoull(row[i], nullptr, 0);
+		return parseInteger<unsigned long long>(row[i], getLength(i));
 	}
 
 	std::optional<unsigned long long> getNullableUnsignedLongLong( const std::string &field ) const
@@ -412,7 +973,7 @@ public:
 	{
 		if(row[i] == NULL)
 			return std::optional<unsigned long long>();
-		return std::optional<unsigned long long>(strtoull(row[i], nullptr, 0));
+		return std::optional<unsigned long long>(getUnsignedLongLong(i));
 	}
 
 	// String retrieval
@@ -422,7 +983,7 @@ public:
 	}
 	std::string getString( const int i ) const
 	{
-		return row[i];
+		return row[i] == nullptr ? std::string() : std::string(row[i], getLength(i));
 	}
 
 	std::optional<std::string> getNullableString( const std::string &Field ) const
@@ -431,7 +992,27 @@ public:
 	}
 	std::optional<std::string> getNullableString( const int i ) const
 	{
-		return row[i] == nullptr ? std::optional<std::string>() : std::optional<std::string>(std::string(row[i]));
+		return row[i] == nullptr ? std::optional<std::string>() : std::optional<std::string>(std::string(row[i], getLength(i)));
+	}
+
+	// String view retrieval. The view points into the query's result, so it is valid for as
+	//	long as the query is alive. For a streaming query it is valid until the next row is read.
+	std::string_view getStringView( const std::string &Field ) const
+	{
+		return getStringView( getIndexByField(Field) );
+	}
+	std::string_view getStringView( const int i ) const
+	{
+		return row[i] == nullptr ? std::string_view() : std::string_view(row[i], getLength(i));
+	}
+
+	std::optional<std::string_view> getNullableStringView( const std::string &Field ) const
+	{
+		return getNullableStringView( getIndexByField(Field) );
+	}
+	std::optional<std::string_view> getNullableStringView( const int i ) const
+	{
+		return row[i] == nullptr ? std::optional<std::string_view>() : std::optional<std::string_view>(getStringView(i));
 	}
 
 	// Signed float retrieval
@@ -443,9 +1024,7 @@ public:
 	{
 		if(row[i] == NULL)
 			return 0;
-		float f;
-		sscanf(row[i], "%f", &f);
-		return f;
+		return (float)parseDouble(row[i], getLength(i));
 	}
 	std::optional<float> getNullableFloat( const int i ) const
 	{
@@ -465,7 +1044,7 @@ public:
 	}
 	double getDouble( const int i ) const
 	{
-		return atof(row[i]);
+		return row[i] == nullptr ? 0 : parseDouble(row[i], getLength(i));
 	}
 
 	std::optional<double> getNullableDouble( const std::string &Field ) const
@@ -480,18 +1059,7 @@ public:
 	// Timestamp retrieval
 	time_t getTimestamp( const int i ) const
 	{
-		tm t;
-		memset(&t, 0, sizeof(tm));
-		t.tm_isdst = -1;
-		if(row[i] == NULL || sscanf(row[i], "%d-%d-%d %d:%d:%d",
-		&t.tm_year,&t.tm_mon,&t.tm_mday,&t.tm_hour,&t.tm_min,&t.tm_sec) != 6)
-		{
-			return 0;
-		}
-		t.tm_mon -= 1;
-		t.tm_year -= 1900;
-
-		return mktime(&t);
+		return row[i] == nullptr ? 0 : parseTimestamp(row[i], getLength(i));
 	}
 	time_t getTimestamp( const std::string &field ) const
 	{
@@ -508,29 +1076,1215 @@ public:
 	}
 };
 
+//A result copied out of the client library into one block of memory, stored column by column.
+//	Each column keeps its cells back to back, an offset per row, and a bitmap of NULL cells.
+//	Every cell is followed by a NUL byte, so it can also be read as a C string.
+class _MaterializedResult
+{
+private:
+	unsigned int rowCount;
+	unsigned int fieldCount;
+	size_t wordsPerColumn;	//Words of the NULL bitmap per column.
+	size_t arenaSize;
+	std::unique_ptr< unsigned char[] > arena;	//The NULL bitmaps, then the offsets, then the cell data.
+	const uint64_t *nullBits;
+	const size_t *offsets;	//rowCount + 1 offsets into data per column. A cell ends one byte before the next starts.
+	const char *data;
+	sqlFieldSet fields;
+	std::string request;
+	std::string version;	//Whatever the snapshot was saved with, to tell whether it is out of date.
+	std::shared_ptr< void > mapping;	//Keeps the file of a snapshot from open() mapped, in place of the arena.
+
+	friend class _Query;
+
+	void fill( const std::vector< MYSQL_ROW > &rows, const std::vector< unsigned long > &lengths, const sqlFieldSet &fields );
+public:
+	_MaterializedResult();
+
+	//A result built from values in memory rather than read from a server, for tests,
+	//	benchmarks and data that comes from elsewhere. An empty optional is a NULL.
+	static MaterializedResult create( const std::vector< std::string > &fieldNames,
+		const std::vector< std::vector< std::optional< std::string > > > &values );
+
+	unsigned int numRows() const { return rowCount; }
+	unsigned int numFields() const { return fieldCount; }
+	size_t getMemoryUsage() const { return arenaSize; }
+
+	bool isNull( const size_t row, const int column ) const
+	{
+		return ( nullBits[ column * wordsPerColumn + row / 64 ] >> (row % 64) ) & 1;
+	}
+	const char *getCell( const size_t row, const int column ) const
+	{
+		return isNull( row, column ) ? nullptr : data + offsets[ column * (rowCount + 1) + row ];
+	}
+	size_t getCellLength( const size_t row, const int column ) const
+	{
+		const size_t *columnOffsets = offsets + column * (rowCount + 1);
+		return columnOffsets[ row + 1 ] - columnOffsets[ row ] - 1;
+	}
+
+	int getIndexByField( const std::string &field ) const;
+	bool hasField( const std::string &field ) const { return fields.find( field ) >= 0; }
+	Column getColumn( const std::string &field ) const { return Column( getIndexByField(field) ); }
+	std::string getFieldByIndex( const int index ) const;
+	std::string getQueryBuffer() const { return request; }
+
+	MaterializedRow getRow( const size_t index ) const;
+
+	//The same as _Query::extractColumns(), reading from the arena.
+	template< typename... Types >
+	std::tuple< ColumnVector< Types >... > extractColumns( const std::array< Column, sizeof...(Types) > &columns, const unsigned int threads = 1 ) const;
+	template< typename T >
+	ColumnVector< T > extractColumn( const Column column, const unsigned int threads = 1 ) const;
+	template< typename T >
+	ColumnVector< T > extractColumn( const std::string &field, const unsigned int threads = 1 ) const { return extractColumn< T >( getColumn(field), threads ); }
+
+	//Write the result to a snapshot file that open() maps back into memory, so data that rarely
+	//	changes can be kept between runs instead of selected again. The version is stored with it,
+	//	such as a table's update time, for the caller to compare before trusting the snapshot.
+	//	The file is written under a unique name beside the path, flushed to disk and renamed over
+	//	it, so readers and other writers of the same path never see half of it.
+	void save( const std::string &path, const std::string &version = std::string() ) const;
+
+	//Map a snapshot written by save(). The cells are read from the mapping in place. Opening
+	//	reads the checksum over every page, unless verifyChecksum is false, and always checks
+	//	the cell offsets, so a damaged file cannot lead to reads outside the mapping.
+	//	Throws a QueryException if the file cannot be read, is damaged, or was written by a build
+	//	with a different byte order or word size.
+	static MaterializedResult open( const std::string &path, const bool verifyChecksum = true );
+	const std::string &getVersion() const { return version; }
+	bool isMapped() const { return mapping != nullptr; }
+};
+
+//The typed getters shared by the lightweight row views. Derived supplies getCell( i ), which is
+//	NULL for a NULL field, getLength( i ) and getIndexByField( name ).
+template< typename Derived >
+class CellReader
+{
+private:
+	const Derived &self() const { return static_cast< const Derived& >( *this ); }
+	int indexOf( const std::string &field ) const { return self().getIndexByField( field ); }
+
+	template< typename T >
+	T parseCell( const int i ) const
+	{
+		const char *cell = self().getCell( i );
+		return cell == nullptr ? 0 : parseInteger< T >( cell, self().getLength(i) );
+	}
+public:
+	bool isFieldNull( const int i ) const { return self().getCell( i ) == nullptr; }
+	bool isFieldNull( const std::string &field ) const { return isFieldNull( indexOf(field) ); }
+
+	std::string_view getStringView( const int i ) const
+	{
+		const char *cell = self().getCell( i );
+		return cell == nullptr ? std::string_view() : std::string_view( cell, self().getLength(i) );
+	}
+	std::string_view getStringView( const std::string &field ) const { return getStringView( indexOf(field) ); }
+	std::optional<std::string_view> getNullableStringView( const int i ) const
+	{
+		return isFieldNull(i) ? std::optional<std::string_view>() : getStringView(i);
+	}
+	std::optional<std::string_view> getNullableStringView( const std::string &field ) const { return getNullableStringView( indexOf(field) ); }
+	std::string getString( const int i ) const { return std::string( getStringView(i) ); }
+	std::string getString( const std::string &field ) const { return getString( indexOf(field) ); }
+	std::optional<std::string> getNullableString( const int i ) const
+	{
+		return isFieldNull(i) ? std::optional<std::string>() : getString(i);
+	}
+	std::optional<std::string> getNullableString( const std::string &field ) const { return getNullableString( indexOf(field) ); }
+
+	int getInt( const int i ) const { return parseCell< int >( i ); }
+	int getInt( const std::string &field ) const { return getInt( indexOf(field) ); }
+	unsigned int getUnsignedInt( const int i ) const { return parseCell< unsigned int >( i ); }
+	unsigned int getUnsignedInt( const std::string &field ) const { return getUnsignedInt( indexOf(field) ); }
+	short getShort( const int i ) const { return parseCell< short >( i ); }
+	short getShort( const std::string &field ) const { return getShort( indexOf(field) ); }
+	unsigned short getUnsignedShort( const int i ) const { return parseCell< unsigned short >( i ); }
+	unsigned short getUnsignedShort( const std::string &field ) const { return getUnsignedShort( indexOf(field) ); }
+	long long getLongLong( const int i ) const { return parseCell< long long >( i ); }
+	long long getLongLong( const std::string &field ) const { return getLongLong( indexOf(field) ); }
+	unsigned long long getUnsignedLongLong( const int i ) const { return parseCell< unsigned long long >( i ); }
+	unsigned long long getUnsignedLongLong( const std::string &field ) const { return getUnsignedLongLong( indexOf(field) ); }
+	std::optional<int> getNullableInt( const int i ) const { return isFieldNull(i) ? std::optional<int>() : getInt(i); }
+	std::optional<int> getNullableInt( const std::string &field ) const { return getNullableInt( indexOf(field) ); }
+	std::optional<long long> getNullableLongLong( const int i ) const { return isFieldNull(i) ? std::optional<long long>() : getLongLong(i); }
+	std::optional<long long> getNullableLongLong( const std::string &field ) const { return getNullableLongLong( indexOf(field) ); }
+	std::optional<unsigned int> getNullableUnsignedInt( const int i ) const { return isFieldNull(i) ? std::optional<unsigned int>() : getUnsignedInt(i); }
+	std::optional<unsigned int> getNullableUnsignedInt( const std::string &field ) const { return getNullableUnsignedInt( indexOf(field) ); }
+	std::optional<short> getNullableShort( const int i ) const { return isFieldNull(i) ? std::optional<short>() : getShort(i); }
+	std::optional<short> getNullableShort( const std::string &field ) const { return getNullableShort( indexOf(field) ); }
+	std::optional<unsigned short> getNullableUnsignedShort( const int i ) const { return isFieldNull(i) ? std::optional<unsigned short>() : getUnsignedShort(i); }
+	std::optional<unsigned short> getNullableUnsignedShort( const std::string &field ) const { return getNullableUnsignedShort( indexOf(field) ); }
+	std::optional<unsigned long long> getNullableUnsignedLongLong( const int i ) const { return isFieldNull(i) ? std::optional<unsigned long long>() : getUnsignedLongLong(i); }
+	std::optional<unsigned long long> getNullableUnsignedLongLong( const std::string &field ) const { return getNullableUnsignedLongLong( indexOf(field) ); }
+
+	char getChar( const int i ) const
+	{
+		const char *cell = self().getCell( i );
+		return cell == nullptr ? '\0' : cell[0];
+	}
+	char getChar( const std::string &field ) const { return getChar( indexOf(field) ); }
+	std::optional<char> getNullableChar( const int i ) const { return isFieldNull(i) ? std::optional<char>() : getChar(i); }
+	std::optional<char> getNullableChar( const std::string &field ) const { return getNullableChar( indexOf(field) ); }
+
+	double getDouble( const int i ) const
+	{
+		const char *cell = self().getCell( i );
+		return cell == nullptr ? 0 : parseDouble( cell, self().getLength(i) );
+	}
+	double getDouble( const std::string &field ) const { return getDouble( indexOf(field) ); }
+	float getFloat( const int i ) const { return (float)getDouble( i ); }
+	float getFloat( const std::string &field ) const { return getFloat( indexOf(field) ); }
+	std::optional<float> getNullableFloat( const int i ) const { return isFieldNull(i) ? std::optional<float>() : getFloat(i); }
+	std::optional<float> getNullableFloat( const std::string &field ) const { return getNullableFloat( indexOf(field) ); }
+	std::optional<double> getNullableDouble( const int i ) const { return isFieldNull(i) ? std::optional<double>() : getDouble(i); }
+	std::optional<double> getNullableDouble( const std::string &field ) const { return getNullableDouble( indexOf(field) ); }
+
+	time_t getTimestamp( const int i ) const
+	{
+		const char *cell = self().getCell( i );
+		return cell == nullptr ? 0 : parseTimestamp( cell, self().getLength(i) );
+	}
+	time_t getTimestamp( const std::string &field ) const { return getTimestamp( indexOf(field) ); }
+	std::optional<time_t> getNullableTimestamp( const int i ) const { return isFieldNull(i) ? std::optional<time_t>() : getTimestamp(i); }
+	std::optional<time_t> getNullableTimestamp( const std::string &field ) const { return getNullableTimestamp( indexOf(field) ); }
+};
+
+//A row of a MaterializedResult. It holds no reference to the result, which must outlive it,
+//	so it is free to copy and to keep in containers.
+class MaterializedRow : public CellReader< MaterializedRow >
+{
+private:
+	const _MaterializedResult *result;
+	size_t index;
+public:
+	MaterializedRow() { result = NULL; index = 0; }
+	MaterializedRow( const _MaterializedResult *result, const size_t index ) { this->result = result; this->index = index; }
+
+	size_t getRowIndex() const { return index; }
+	int getIndexByField( const std::string &field ) const { return result->getIndexByField( field ); }
+
+	const char *getCell( const int i ) const { return result->getCell( index, i ); }
+	size_t getLength( const int i ) const { return result->getCellLength( index, i ); }
+	size_t getLength( const std::string &field ) const { return getLength( getIndexByField(field) ); }
+};
+
+inline MaterializedRow _MaterializedResult::getRow( const size_t index ) const
+{
+	if( index >= rowCount )
+		throw QueryException("The row index is past the end of the result.");
+	return MaterializedRow( this, index );
+}
+
+//A row of a buffered _Query, read in place. Unlike Row it takes no reference on the query and
+//	touches no counters, so it costs two words to make and copy. It is only valid while the
+//	query is alive and its result is not cleared. Use toRow() to keep a row beyond that.
+class RowView : public CellReader< RowView >
+{
+private:
+	const _Query *query;
+	size_t index;
+public:
+	RowView() { query = NULL; index = 0; }
+	RowView( const _Query *query, const size_t index ) { this->query = query; this->index = index; }
+
+	size_t getRowIndex() const { return index; }
+	int getIndexByField( const std::string &field ) const { return query->getIndexByField( field ); }
+
+	const char *getCell( const int i ) const { return query->rows[ index ][ i ]; }
+	size_t getLength( const int i ) const { return query->rows[ index ][ i ] == nullptr ? 0 : query->getRowLengths( index )[ i ]; }
+	size_t getLength( const std::string &field ) const { return getLength( getIndexByField(field) ); }
+
+	Row toRow() const { return query->getRow( index ); }
+};
+
+//Walks the rows of a buffered _Query, from the first, without moving its getRow() cursor.
+class QueryIterator
+{
+private:
+	const _Query *query;
+	size_t index;
+public:
+	typedef std::forward_iterator_tag iterator_category;
+	typedef RowView value_type;
+	typedef std::ptrdiff_t difference_type;
+	typedef const RowView *pointer;
+	typedef RowView reference;
+
+	QueryIterator() { query = NULL; index = 0; }
+	QueryIterator( const _Query *query, const size_t index ) { this->query = query; this->index = index; }
+
+	RowView operator*() const { return RowView( query, index ); }
+	QueryIterator &operator++() { ++index; return *this; }
+	QueryIterator operator++( int ) { QueryIterator previous = *this; ++index; return previous; }
+	bool operator==( const QueryIterator &other ) const { return index == other.index && query == other.query; }
+	bool operator!=( const QueryIterator &other ) const { return !(*this == other); }
+};
+
+inline QueryIterator _Query::begin() const
+{
+	if( streaming )
+		throw QueryException("The rows of a streaming query cannot be iterated over. Use getRow() instead.", NULL, request.c_str());
+	return QueryIterator( this, 0 );
+}
+inline QueryIterator _Query::end() const
+{
+	return QueryIterator( this, streaming ? 0 : rows.size() );
+}
+
+//A DATETIME or TIMESTAMP column read as a unix timestamp. time_t is an ordinary integer type,
+//	so typed reads need this to tell a date from a number.
+struct Timestamp
+{
+	time_t value;
+
+	Timestamp() { value = 0; }
+	Timestamp( const time_t value ) { this->value = value; }
+	operator time_t() const { return value; }
+};
+
+//How a column is read into each C++ type. The row may be a Row, a RowView or a MaterializedRow.
+//	A type without a FieldReader does not compile.
+template< typename T >
+struct FieldReader;
+
+template<> struct FieldReader< int >
+{
+	template< typename RowType > static int read( const RowType &row, const int i ) { return row.getInt( i ); }
+};
+template<> struct FieldReader< unsigned int >
+{
+	template< typename RowType > static unsigned int read( const RowType &row, const int i ) { return row.getUnsignedInt( i ); }
+};
+template<> struct FieldReader< short >
+{
+	template< typename RowType > static short read( const RowType &row, const int i ) { return row.getShort( i ); }
+};
+template<> struct FieldReader< long >
+{
+	template< typename RowType > static long read( const RowType &row, const int i ) { return (long)row.getLongLong( i ); }
+};
+template<> struct FieldReader< long long >
+{
+	template< typename RowType > static long long read( const RowType &row, const int i ) { return row.getLongLong( i ); }
+};
+template<> struct FieldReader< unsigned long long >
+{
+	template< typename RowType > static unsigned long long read( const RowType &row, const int i ) { return row.getUnsignedLongLong( i ); }
+};
+template<> struct FieldReader< bool >
+{
+	template< typename RowType > static bool read( const RowType &row, const int i ) { return row.getInt( i ) != 0; }
+};
+template<> struct FieldReader< char >
+{
+	template< typename RowType > static char read( const RowType &row, const int i ) { return row.getChar( i ); }
+};
+template<> struct FieldReader< float >
+{
+	template< typename RowType > static float read( const RowType &row, const int i ) { return row.getFloat( i ); }
+};
+template<> struct FieldReader< double >
+{
+	template< typename RowType > static double read( const RowType &row, const int i ) { return row.getDouble( i ); }
+};
+template<> struct FieldReader< std::string >
+{
+	template< typename RowType > static std::string read( const RowType &row, const int i ) { return row.getString( i ); }
+};
+//Points into the result, so it is only valid while the result is.
+template<> struct FieldReader< std::string_view >
+{
+	template< typename RowType > static std::string_view read( const RowType &row, const int i ) { return row.getStringView( i ); }
+};
+template<> struct FieldReader< Timestamp >
+{
+	template< typename RowType > static Timestamp read( const RowType &row, const int i ) { return Timestamp( row.getTimestamp( i ) ); }
+};
+//NULL reads as an empty optional. Without optional a NULL reads as zero or empty, as the Row getters do.
+template< typename T > struct FieldReader< std::optional< T > >
+{
+	template< typename RowType > static std::optional< T > read( const RowType &row, const int i )
+	{
+		return row.isFieldNull( i ) ? std::optional< T >() : std::optional< T >( FieldReader< T >::read( row, i ) );
+	}
+};
+
+//A column name paired with the Record member it is read into. Made with sql::field().
+template< typename Record, typename Member >
+struct FieldMapping
+{
+	const char *name;
+	Member Record::*member;
+};
+
+template< typename Record, typename Member >
+FieldMapping< Record, Member > field( const char *name, Member Record::*member )
+{
+	return FieldMapping< Record, Member >{ name, member };
+}
+
+template< typename Tuple >
+struct TupleReader;
+
+template< typename... Types >
+struct TupleReader< std::tuple< Types... > >
+{
+	template< typename RowType, size_t... Indexes >
+	static std::tuple< Types... > read( const RowType &row, std::index_sequence< Indexes... > )
+	{
+		return std::tuple< Types... >( FieldReader< Types >::read( row, (int)Indexes )... );
+	}
+	template< typename RowType >
+	static std::tuple< Types... > read( const RowType &row )
+	{
+		return read( row, std::index_sequence_for< Types... >() );
+	}
+};
+
+template< typename Tuple >
+std::vector< Tuple > _Query::as() const
+{
+	if( fields.size() < std::tuple_size< Tuple >::value )
+		throw FieldException("The result has fewer columns than the tuple it is read into.");
+
+	std::vector< Tuple > records;
+	records.reserve( rows.size() );
+	for( RowView row : *this )
+		records.push_back( TupleReader< Tuple >::read( row ) );
+	return records;
+}
+
+template< typename Record, typename... Members >
+std::vector< Record > _Query::as( const FieldMapping< Record, Members >&... mappings ) const
+{
+	const int columns[] = { getIndexByField( mappings.name )..., -1 };
+
+	std::vector< Record > records;
+	records.reserve( rows.size() );
+	for( RowView row : *this )
+	{
+		Record record;
+		size_t i = 0;
+		((record.*(mappings.member) = FieldReader< Members >::read( row, columns[ i++ ] )), ...);
+		records.push_back( std::move( record ) );
+	}
+	return records;
+}
+
+//One column of a result read into a contiguous vector, so that loops over it need no lookups
+//	or parsing. A NULL cell holds the value a Row getter returns for NULL, zero or empty,
+//	and sets its bit in nullBits. Read boolean columns as char or int, as std::vector< bool >
+//	is not contiguous.
+template< typename T >
+struct ColumnVector
+{
+	static_assert( !std::is_same< T, bool >::value, "std::vector< bool > is not contiguous. Read the column as char or int." );
+
+	std::vector< T > values;
+	std::vector< uint64_t > nullBits;	//Bit row % 64 of word row / 64 is set when the row's cell is NULL.
+
+	size_t size() const { return values.size(); }
+	const T &operator[]( const size_t row ) const { return values[ row ]; }
+	const T *data() const { return values.data(); }
+	bool isNull( const size_t row ) const { return ( nullBits[ row / 64 ] >> (row % 64) ) & 1; }
+	size_t nullCount() const
+	{
+		size_t count = 0;
+		for(uint64_t word : nullBits)
+			for(;word;word &= word - 1)
+				++count;
+		return count;
+	}
+
+	void resize( const size_t rowCount )
+	{
+		values.assign( rowCount, T() );
+		nullBits.assign( (rowCount + 63) / 64, 0 );
+	}
+	template< typename RowType >
+	void read( const RowType &row, const size_t index, const int column )
+	{
+		if( row.isFieldNull( column ) )
+			nullBits[ index / 64 ] |= (uint64_t)1 << (index % 64);
+		else
+			values[ index ] = FieldReader< T >::read( row, column );
+	}
+};
+
+//Read the columns of every row of a result into ColumnVectors. RowType is the result's row view,
+//	made from the result and a row index. Each thread's range starts on a multiple of 64 rows,
+//	so no two threads write the same word of a NULL bitmap.
+template< typename RowType, typename Result, typename... Types >
+std::tuple< ColumnVector< Types >... > extractColumnVectors( const Result *result, const size_t rowCount,
+	const std::array< Column, sizeof...(Types) > &columns, unsigned int threads )
+{
+	for(const Column &column : columns)
+	{
+		if( column.getIndex() < 0 || column.getIndex() >= (int)result->numFields() )
+			throw FieldException("The column index is past the end of the result.");
+	}
+
+	std::tuple< ColumnVector< Types >... > vectors;
+	std::apply( [rowCount]( ColumnVector< Types >&... vector ) { (vector.resize( rowCount ), ...); }, vectors );
+
+	auto readRange = [&]( const size_t first, const size_t last )
+	{
+		for(size_t index = first;index < last;++index)
+		{
+			RowType row( result, index );
+			size_t i = 0;
+			std::apply( [&]( ColumnVector< Types >&... vector ) { (vector.read( row, index, columns[ i++ ] ), ...); }, vectors );
+		}
+	};
+
+	//Starting a thread costs about as much as reading a few thousand cells.
+	const size_t minimumRowsPerThread = 4096;
+	if( threads == 0 )
+		threads = std::max( std::thread::hardware_concurrency(), 1u );
+	threads = (unsigned int)std::min< size_t >( threads, std::max< size_t >( rowCount / minimumRowsPerThread, 1 ) );
+	if( threads <= 1 )
+	{
+		readRange( 0, rowCount );
+		return vectors;
+	}
+
+	const size_t rowsPerThread = ( (rowCount + threads - 1) / threads + 63 ) & ~(size_t)63;
+	std::vector< std::thread > workers;
+	std::vector< std::exception_ptr > errors( threads );
+	for(unsigned int thread = 1;thread < threads;++thread)
+	{
+		const size_t first = std::min( rowCount, thread * rowsPerThread );
+		const size_t last = std::min( rowCount, first + rowsPerThread );
+		workers.emplace_back( [&readRange, &errors, thread, first, last]()
+		{
+			try {
+				readRange( first, last );
+			} catch( ... ) {
+				errors[ thread ] = std::current_exception();
+			}
+		} );
+	}
+	try {
+		readRange( 0, std::min( rowCount, rowsPerThread ) );
+	} catch( ... ) {
+		errors[ 0 ] = std::current_exception();
+	}
+	for(std::thread &worker : workers)
+		worker.join();
+	for(const std::exception_ptr &error : errors)
+	{
+		if( error )
+			std::rethrow_exception( error );
+	}
+	return vectors;
+}
+
+template< typename... Types >
+std::tuple< ColumnVector< Types >... > _Query::extractColumns( const std::array< Column, sizeof...(Types) > &columns, const unsigned int threads ) const
+{
+	if( streaming )
+		throw QueryException("The columns of a streaming query cannot be extracted. Use getRow() instead.", NULL, request.c_str());
+	return extractColumnVectors< RowView, _Query, Types... >( this, rows.size(), columns, threads );
+}
+template< typename T >
+ColumnVector< T > _Query::extractColumn( const Column column, const unsigned int threads ) const
+{
+	return std::get< 0 >( extractColumns< T >( { column }, threads ) );
+}
+
+template< typename... Types >
+std::tuple< ColumnVector< Types >... > _MaterializedResult::extractColumns( const std::array< Column, sizeof...(Types) > &columns, const unsigned int threads ) const
+{
+	return extractColumnVectors< MaterializedRow, _MaterializedResult, Types... >( this, rowCount, columns, threads );
+}
+template< typename T >
+ColumnVector< T > _MaterializedResult::extractColumn( const Column column, const unsigned int threads ) const
+{
+	return std::get< 0 >( extractColumns< T >( { column }, threads ) );
+}
+
+//The flag type MYSQL_BIND points to. This is my_bool in older client libraries and bool in MySQL 8.
+typedef std::remove_pointer< decltype( MYSQL_BIND::is_null ) >::type sqlBindFlag;
+
+//A server-side prepared statement. Parameters are sent and results are read using the binary
+//	protocol, so values are never formatted into or parsed from text.
+//	Statements are created by _Connection::prepareStatement() and must not outlive their connection.
+class _PreparedStatement
+{
+private:
+	struct Parameter
+	{
+		MYSQL_BIND *bind;
+		long long integer;
+		double real;
+		MYSQL_TIME time;
+		std::string text;
+		unsigned long length;
+		sqlBindFlag isNull;
+	};
+	struct ResultColumn
+	{
+		long long integer;
+		double real;
+		MYSQL_TIME time;
+		std::vector< char > text;
+		unsigned long length;
+		sqlBindFlag isNull;
+		sqlBindFlag error;
+		enum_field_types type;
+	};
+
+	_Connection* server;
+	MYSQL_STMT* statement;
+	MYSQL_RES* metadata;	//Result field information, or NULL if the statement returns no rows.
+	std::string request;
+
+	std::vector< MYSQL_BIND > parameterBinds;
+	std::vector< Parameter > parameters;
+	bool parametersChanged;	//Set when a buffer address or type changed, so the parameters must be bound again.
+
+	std::vector< MYSQL_BIND > resultBinds;
+	std::vector< ResultColumn > columns;
+	sqlFieldSet fields;
+	bool hasRow;
+
+	void throwError( const std::string &message );
+	Parameter &getParameter( const unsigned int index, const enum_field_types type, const bool isUnsigned );
+	const ResultColumn &getColumn( const int index ) const;
+	void setupResult();
+public:
+	_PreparedStatement( _Connection *connection, const std::string &request );
+	~_PreparedStatement();
+
+	unsigned int numParameters();
+	unsigned int numFields();
+	my_ulonglong numRows();
+	my_ulonglong lastInsertID();
+	std::string getQueryBuffer() { return request; }
+
+	//Parameters are numbered from zero, in the order the '?' placeholders appear.
+	//	Values are kept between executions, so only the ones that change need to be set again.
+	void setNull( const unsigned int index );
+	void setInt( const unsigned int index, const int value );
+	void setUnsignedInt( const unsigned int index, const unsigned int value );
+	void setLongLong( const unsigned int index, const long long value );
+	void setUnsignedLongLong( const unsigned int index, const unsigned long long value );
+	void setBool( const unsigned int index, const bool value );
+	void setDouble( const unsigned int index, const double value );
+	void setString( const unsigned int index, const std::string &value );
+	void setString( const unsigned int index, const char *value, const size_t length );
+	void setTimestamp( const unsigned int index, const time_t value );
+
+	//Run the statement with the current parameters, returning the number of affected rows.
+	//	Any result is buffered on the client so the connection is free as soon as this returns.
+	my_ulonglong execute();
+	//Advance to the next result row. Returns false once every row has been read.
+	bool fetch();
+
+	int getIndexByField( const std::string &field );
+	Column getColumn( const std::string &field ) { return Column( getIndexByField(field) ); }
+	bool isFieldNull( const int index ) const;
+	bool isFieldNull( const std::string &field ) { return isFieldNull( getIndexByField(field) ); }
+
+	int getInt( const int index ) const { return (int)getLongLong(index); }
+	int getInt( const std::string &field ) { return getInt( getIndexByField(field) ); }
+	unsigned int getUnsignedInt( const int index ) const { return (unsigned int)getUnsignedLongLong(index); }
+	unsigned int getUnsignedInt( const std::string &field ) { return getUnsignedInt( getIndexByField(field) ); }
+	short getShort( const int index ) const { return (short)getLongLong(index); }
+	short getShort( const std::string &field ) { return getShort( getIndexByField(field) ); }
+	long long getLongLong( const int index ) const;
+	long long getLongLong( const std::string &field ) { return getLongLong( getIndexByField(field) ); }
+	unsigned long long getUnsignedLongLong( const int index ) const { return (unsigned long long)getLongLong(index); }
+	unsigned long long getUnsignedLongLong( const std::string &field ) { return getUnsignedLongLong( getIndexByField(field) ); }
+	bool getBool( const int index ) const { return getLongLong(index) != 0; }
+	bool getBool( const std::string &field ) { return getBool( getIndexByField(field) ); }
+	double getDouble( const int index ) const;
+	double getDouble( const std::string &field ) { return getDouble( getIndexByField(field) ); }
+	float getFloat( const int index ) const { return (float)getDouble(index); }
+	float getFloat( const std::string &field ) { return getFloat( getIndexByField(field) ); }
+	std::string getString( const int index ) const;
+	std::string getString( const std::string &field ) { return getString( getIndexByField(field) ); }
+	time_t getTimestamp( const int index ) const;
+	time_t getTimestamp( const std::string &field ) { return getTimestamp( getIndexByField(field) ); }
+};
+
 class _Connection
 {
 private:
 	std::string databaseName;	//Name of the database
 	MYSQL* server;		//The SQL server
-
+	std::string host;	//Remembered by connect() for reconnecting.
+	std::string user;
+	std::string password;
+	ConnectionOptions options;
+
+	bool autoReconnect;
+	bool reconnectPending;	//The connection was lost under a statement that could not be retried.
+	unsigned int reconnectAttempts;
+	std::chrono::milliseconds initialBackoff;
+	std::chrono::milliseconds maxBackoff;
+	_Query* activeStream;	//Streaming query currently reading from this connection, if any.
+	_AsyncQuery* activeAsyncQuery;	//Non-blocking query in flight on this connection, if any.
+	bool localInfile;	//LOAD DATA LOCAL INFILE is allowed when the connection is opened.
+	std::string_view localInfileData;	//What a running BulkLoader load is sending in place of a file.
+	QueryCache queryCache;
+	QueryProfiler queryProfiler;
+
+	//Updated by the thread using the connection, and read by anyone taking a snapshot.
+	struct MetricCounters
+	{
+		std::atomic< unsigned long long > queries;
+		std::atomic< unsigned long long > failedQueries;
+		std::atomic< unsigned long long > bytesSent;
+		std::atomic< unsigned long long > bytesReceived;
+		std::atomic< unsigned long long > rowsFetched;
+		std::atomic< unsigned long long > totalLatencyMicroseconds;
+		std::atomic< unsigned long long > latencyHistogram[ ConnectionMetrics::latencyBuckets ];
+	};
+	MetricCounters metrics;
+
+	friend class _Query;
+	friend class _PreparedStatement;
+	friend class _AsyncQuery;
+	friend class _WriteBehindQueue;
+	friend class BulkLoader;
+
+	void openServer();
+	void applyOptions();
+	void reconnectWithBackoff();
+	static bool isIdempotent( const char *query, const size_t length );
+	void checkAvailable();
+	void releaseStream( _Query *query );
+	bool discardPendingResults();
+	int runQuery( const char *query, const size_t length, QueryTiming &timing );
+	void recordQuery( const char *query, const size_t length, const QueryTiming &timing );
+	void recordRows( const size_t rows, const size_t bytes );
+	my_ulonglong loadLocalInfile( const std::string &statement, std::string_view data, unsigned int &warnings );
+
+	//The client library's local infile callbacks. They only ever read localInfileData.
+	static int localInfileInit( void **state, const char *fileName, void *connection );
+	static int localInfileRead( void *state, char *buffer, unsigned int length );
+	static void localInfileEnd( void *state );
+	static int localInfileError( void *state, char *message, unsigned int length );
 public:
 	_Connection( const std::string &host, const std::string &user, const std::string &password, const std::string &name );
+	_Connection( const std::string &host, const std::string &user, const std::string &password, const std::string &name, const ConnectionOptions &options );
 	_Connection();
 	~_Connection();
 
+	//Options for the next connect() or reconnect(). They do not change an open connection.
+	void setOptions( const ConnectionOptions &options ) { this->options = options; }
+	const ConnectionOptions &getOptions() { return options; }
+
 	void connect( const std::string &host, const std::string &user, const std::string &password, const std::string &name );
 
+	//Close the connection and open it again with the parameters last given to connect().
+	//	Prepared statements made before a reconnect can no longer be used.
+	void reconnect();
+
+	//When enabled, a connection lost to a server restart or timeout is opened again automatically,
+	//	retrying up to maxAttempts times and doubling the wait after each failure up to maxBackoff.
+	//	A lost read (SELECT, SHOW, DESCRIBE or EXPLAIN) is then sent again, so the caller never sees
+	//	the failure. Anything else still throws, because it may already have run, and the connection
+	//	is reopened before the next statement. Nothing is retried or reopened inside a transaction,
+	//	whose work the server has already rolled back.
+	void setAutoReconnect( const bool enabled, const unsigned int maxAttempts = 5,
+		const std::chrono::milliseconds initialBackoff = std::chrono::milliseconds(100),
+		const std::chrono::milliseconds maxBackoff = std::chrono::milliseconds(5000) );
+	bool getAutoReconnect() { return autoReconnect; }
+
+	//Allow LOAD DATA LOCAL INFILE, which BulkLoader needs. This takes effect the next time the
+	//	connection is opened by connect() or reconnect(). The server is only ever sent the rows of
+	//	a running BulkLoader, never a local file, whatever file name it asks for.
+	void setLocalInfile( const bool enabled ) { localInfile = enabled; }
+	bool getLocalInfile() { return localInfile; }
+	const char *getCharacterSet();
+
 	bool isConnected();
 	void reportError();
 	void reportError( const std::string &logMessage );
 	void sendQuery( Query query );
 	void sendRawQuery( const std::string &query );
+	void sendRawQuery( const char *query, const size_t length );
 	my_ulonglong lastInsertID();
 
 	std::list< std::string > getTableList();
 
-	Query sendQuery( const std::string &queryBuffer );
+	//When the table in the current database last changed, from information_schema, for telling
+	//	whether a snapshot is out of date. Empty when the server does not know, as for InnoDB
+	//	tables before MySQL 8.0 or since a restart. MySQL 8.0 caches the time for
+	//	information_schema_stats_expiry seconds, a day by default, so set that to 0 to rely on it.
+	std::optional< time_t > getTableUpdateTime( const std::string &table );
+
+	//Open the snapshot at path if it was saved from the same query with the same version, or
+	//	else send the query, save its result there and return it. The version can be anything that
+	//	changes with the data, such as getTableUpdateTime() or the result of CHECKSUM TABLE.
+	//	A snapshot that is missing or damaged is replaced. Failing to save it is only reported.
+	MaterializedResult sendSnapshotQuery( const std::string &queryBuffer, const std::string &path, const std::string &version );
+
+	PreparedStatement prepareStatement( const std::string &request );
+
+	//Start a transaction, which rolls back unless it is committed before it is destroyed.
+	//	The connection must outlive it. Throws if a transaction is already open, so use a
+	//	savepoint to nest one unit of work inside another.
+	Transaction beginTransaction( const bool readOnly = false );
+	bool isInTransaction();
+
+	//Escaping that honours the connection's character set, through mysql_real_escape_string().
+	void appendEscapedString( std::string &buffer, const char *str, const size_t length );
+	std::string escapeString( const std::string &str );
+	std::string escapeQuoteString( const std::string &str );
+
+	//The query text is moved into the query when given as a temporary.
+	Query sendQuery( std::string queryBuffer );
+
+	//Send several statements in one round trip and return one result per statement, in order.
+	//	Each buffer must hold exactly one statement, as results are matched to buffers by position.
+	//	A trailing ';' is dropped, and an empty buffer throws a QueryException before anything is sent.
+	//	If a statement fails, the ones after it are not run and a QueryException is thrown.
+	std::vector< Query > sendQueries( const std::vector< std::string > &queryBuffers );
+
+	//Send a query through the connection's result cache. A cached result younger than its time to live
+	//	is returned without a round trip. Otherwise the query is sent, and its result is cached
+	//	under the given table names so that invalidating any of those tables drops it.
+	//	A ttl of zero uses the cache's default. Without a cache the query is always sent.
+	ConstQuery sendCachedQuery( const std::string &queryBuffer, const std::vector< std::string > &tables = {},
+		const std::chrono::milliseconds ttl = std::chrono::milliseconds(0) );
+	void setQueryCache( QueryCache queryCache ) { this->queryCache = queryCache; }
+	QueryCache getQueryCache() { return queryCache; }
+
+	//Send a query whose rows are read from the server one at a time as they are requested.
+	//	The connection is reserved for the stream until every row has been read, or until
+	//	the query is closed or destroyed. Any other query sent meanwhile throws a QueryException.
+	Query streamQuery( std::string queryBuffer );
+	bool hasOpenStream() { return activeStream != NULL; }
+
+#ifdef SQL_DATABASE_ASYNC
+	//Start a query without waiting for the server. The caller waits on the returned query's socket
+	//	in its own event loop and calls poll() when it is ready. The connection is reserved until
+	//	the query completes. The callback, if given, runs as soon as the result has been stored.
+	AsyncQuery sendQueryAsync( const std::string &queryBuffer, std::function< void( AsyncQuery ) > callback = nullptr );
+#endif
+	bool hasPendingQuery() { return activeAsyncQuery != NULL; }
+
+	ConnectionMetrics getMetrics() const;
+	void resetMetrics();
+
+	//Every statement run on the connection is timed and reported to the profiler, if there is one.
+	void setQueryProfiler( QueryProfiler queryProfiler ) { this->queryProfiler = queryProfiler; }
+	QueryProfiler getQueryProfiler() { return queryProfiler; }
+};
+
+//A statement with '?' placeholders that is parsed once and filled in with values for each use:
+//	QueryTemplate findPlayer( "SELECT * FROM players WHERE name=? AND level>=?" );
+//	Query query = findPlayer.send( connection, name, 10 );
+//	Values are written straight into one buffer that is kept between uses, through the same
+//	encoders as BatchInsertStatement. Strings are quoted and escaped, dates are written as quoted
+//	DATETIME text, and nullptr, empty optionals and zero timestamps are written as NULL.
+//	Placeholders inside quotes, backticks and comments are left alone. For statements that
+//	cannot be prepared, this is the fallback to prepareStatement().
+class QueryTemplate
+{
+private:
+	std::string text;
+	std::vector< size_t > placeholders;	//Offset of each '?' in text.
+	std::string buffer;	//The statement being filled in.
+	size_t parametersWritten;
+	bool finished;
+
+	void parse();
+	void beginValue();
+public:
+	QueryTemplate();
+	QueryTemplate( const std::string &text );
+
+	size_t numParameters() const { return placeholders.size(); }
+	const std::string &getText() const { return text; }
+
+	//Fill in the placeholders in order, after start().
+	void start();
+	void putNull();
+	void putString( const char *value, const size_t length );
+	void putString( const std::string &value ) { putString( value.data(), value.size() ); }
+	void putInt( const long long value );
+	void putUnsignedInt( const unsigned long long value );
+	void putDouble( const double value );
+	void putBool( const bool value );
+	void putChar( const char value );
+	void putDate( const time_t value );
+
+	//The finished statement, valid until the next start(). Throws a QueryException if a placeholder has no value.
+	const std::string &str();
+
+	//One overload per kind of value, so that build() can take any mix of them.
+	void put( const std::string &value ) { putString( value ); }
+	void put( std::string_view value ) { putString( value.data(), value.size() ); }
+	void put( const char *value ) { value ? putString( value, strlen(value) ) : putNull(); }
+	void put( std::nullptr_t ) { putNull(); }
+	void put( const bool value ) { putBool( value ); }
+	void put( const char value ) { putChar( value ); }
+	void put( const double value ) { putDouble( value ); }
+	void put( const float value ) { putDouble( value ); }
+	void put( const Timestamp value ) { putDate( value ); }
+	template< typename T >
+	typename std::enable_if< std::is_integral< T >::value && std::is_signed< T >::value >::type put( const T value ) { putInt( value ); }
+	template< typename T >
+	typename std::enable_if< std::is_integral< T >::value && std::is_unsigned< T >::value >::type put( const T value ) { putUnsignedInt( value ); }
+	template< typename T >
+	void put( const std::optional< T > &value ) { value ? put( *value ) : putNull(); }
+
+	template< typename... Values >
+	const std::string &build( const Values&... values )
+	{
+		start();
+		(put( values ), ...);
+		return str();
+	}
+	//Fill in the placeholders and send the statement, keeping its result.
+	template< typename... Values >
+	Query send( Connection connection, const Values&... values )
+	{
+		return connection->sendQuery( build( values... ) );
+	}
+	//Fill in the placeholders and send the statement, without keeping a result.
+	template< typename... Values >
+	void execute( Connection connection, const Values&... values )
+	{
+		const std::string &statement = build( values... );
+		connection->sendRawQuery( statement.data(), statement.size() );
+	}
+};
+
+//A transaction on one connection, begun by _Connection::beginTransaction(). It is rolled back
+//	when destroyed without commit(), such as when an exception unwinds past it, so every path
+//	out of a unit of work either commits or undoes it. Savepoints mark places within it that
+//	can be rolled back to without giving up the whole transaction. Only one transaction can be
+//	open on a connection, and nothing is retried by automatic reconnects while it is.
+class Transaction
+{
+private:
+	_Connection *connection;	//NULL once committed or rolled back.
+	unsigned int savepointsCreated;
+
+	static std::string quoteName( const std::string &name );
+	void run( const std::string &statement );
+public:
+	Transaction() { connection = NULL; savepointsCreated = 0; }
+	Transaction( _Connection *connection, const bool readOnly );
+	Transaction( Transaction &&other ) noexcept;
+	Transaction &operator=( Transaction &&other );
+	Transaction( const Transaction & ) = delete;
+	Transaction &operator=( const Transaction & ) = delete;
+	~Transaction();
+
+	void commit();
+	void rollback();
+	bool isActive() const { return connection != NULL; }
+
+	//Create a savepoint, under a generated name that is returned, or under the given name.
+	//	A savepoint with the name of an existing one replaces it.
+	std::string savepoint();
+	void savepoint( const std::string &name );
+	//Undo everything since the savepoint, which is kept and can be rolled back to again.
+	void rollbackTo( const std::string &name );
+	//Forget the savepoint, keeping what was done since.
+	void release( const std::string &name );
+};
+
+#ifdef SQL_DATABASE_ASYNC
+//A query in flight on the MariaDB non-blocking client API. Each step sends or reads what it can
+//	without blocking, then reports which socket events it needs before it can make more progress.
+class _AsyncQuery : public std::enable_shared_from_this< _AsyncQuery >
+{
+private:
+	enum State { Querying, StoringResult, NextResult, StoringLaterResult, Done };
+
+	_Connection* server;
+	Query query;
+	State state;
+	int waitEvents;	//MYSQL_WAIT_* flags the current step is blocked on.
+	int queryStatus;	//Of mysql_real_query(), then of each mysql_next_result().
+	MYSQL_RES* result;
+	std::optional< QueryException > error;	//Set if the query failed.
+	std::function< void( AsyncQuery ) > callback;
+	std::chrono::steady_clock::time_point started;
+
+	friend class _Connection;
+
+	void advance( int status );
+	void fail( const std::string &message );
+	void complete();
+public:
+	_AsyncQuery( _Connection *connection, Query query, std::function< void( AsyncQuery ) > callback );
+	~_AsyncQuery();
+
+	bool isDone() { return state == Done; }
+
+	//The socket to wait on, the events to wait for, and how long to wait before calling poll() anyway.
+	int getSocket();
+	int getWaitEvents() { return waitEvents; }
+	bool wantsRead() { return (waitEvents & MYSQL_WAIT_READ) != 0; }
+	bool wantsWrite() { return (waitEvents & MYSQL_WAIT_WRITE) != 0; }
+	bool wantsTimeout() { return (waitEvents & MYSQL_WAIT_TIMEOUT) != 0; }
+	unsigned int getTimeout();
+
+	//Continue once the socket reports the given MYSQL_WAIT_* events. Returns true when the query is done.
+	bool poll( const int readyEvents );
+	//Block until the query is done.
+	void wait();
+
+	//The finished query. Throws the QueryException if the query failed.
+	Query getResult();
+};
+#endif
+
+//Runs fire-and-forget statements on a background thread with its own connection, so the caller
+//	never waits on a round trip. Statements are queued on a bounded lock-free queue that any
+//	thread may add to, and are sent in order, several to a packet as one multi-statement query.
+//	Each queued string must be a single statement. A trailing ';' is dropped, and queueing an
+//	empty statement throws a QueryException. Errors are passed to the error callback
+//	on the background thread, or reported to stdout if there is none.
+class _WriteBehindQueue
+{
+private:
+	struct Cell
+	{
+		std::atomic< size_t > sequence;
+		std::string statement;
+	};
+
+	Connection connection;
+	std::function< void( const std::string &, QueryException & ) > errorCallback;
+	size_t maxPacketSize;
+
+	std::unique_ptr< Cell[] > cells;
+	size_t mask;
+	alignas(64) std::atomic< size_t > enqueuePosition;
+	alignas(64) size_t dequeuePosition;	//Only touched by the background thread.
+	std::atomic< size_t > executedPosition;	//Every statement before this position has been run.
+
+	std::atomic< bool > stopping;
+	std::atomic< bool > drainerIdle;
+	std::mutex mutex;
+	std::condition_variable workAvailable;
+	std::condition_variable spaceAvailable;
+	std::condition_variable statementsExecuted;
+	std::thread drainer;
+
+	std::atomic< long long > groupCommitInterval;	//In milliseconds. Zero runs each statement on its own.
+	std::atomic< bool > commitRequested;	//Commit the open group now, for flush().
+
+	bool tryPop( std::string &statement );
+	void wakeDrainer();
+	void drain();
+	size_t execute( std::vector< std::string > &statements, size_t first, const bool inGroup );
+	bool send( const char *packet, const size_t length, QueryTiming &timing );
+	void reconnectIfLost();
+	bool runControlStatement( const char *statement );
+	void abandonGroup( std::vector< std::string > &group, const char *reason );
+	void reportError( const std::string &statement, QueryException &e );
+public:
+	_WriteBehindQueue( Connection connection, const size_t capacity, std::function< void( const std::string &, QueryException & ) > errorCallback );
+	~_WriteBehindQueue();
+
+	//Queue a statement, waiting for room if the queue is full.
+	void enqueue( std::string statement );
+	//Queue a statement if there is room. Returns false, leaving the statement untouched, if the queue is full.
+	bool tryEnqueue( std::string &statement );
+
+	//Wait until every statement queued before this call has been run, and committed when
+	//	grouping commits.
+	void flush();
+
+	//Run the statements that arrive within each interval in one transaction, so a storm of
+	//	small writes costs the server one commit per interval instead of one per statement.
+	//	The interval is timed from the first statement of each group. A statement that fails
+	//	is reported and skipped as usual. If the server rolls the whole transaction back, as it
+	//	does on a deadlock, or the commit fails, every statement of the group is reported to the
+	//	error callback. A zero interval, the default, turns grouping off. Statements queued
+	//	while grouping must not begin or end transactions of their own.
+	void setGroupCommit( const std::chrono::milliseconds interval ) { groupCommitInterval.store( interval.count() ); }
+	std::chrono::milliseconds getGroupCommit() { return std::chrono::milliseconds( groupCommitInterval.load() ); }
+
+	size_t getPendingStatements();
+	size_t getMaxPacketSize() { return maxPacketSize; }
+};
+
+//Stored results of read queries, keyed by their text with runs of whitespace collapsed.
+//	Results are shared read-only between callers and threads, so they are handed out as ConstQuery
+//	and read by position with getRow( index ). Entries expire after their time to live, are dropped
+//	least recently used first once the cache holds more than maxBytes, and can be invalidated by
+//	any table they were cached under. The cache may be shared by several connections.
+class _QueryCache
+{
+private:
+	struct Entry
+	{
+		std::string key;
+		ConstQuery query;
+		size_t bytes;
+		std::chrono::steady_clock::time_point expires;
+		std::vector< std::string > tables;
+	};
+
+	std::mutex mutex;
+	std::list< Entry > entries;	//Most recently used first.
+	std::map< std::string, std::list< Entry >::iterator > index;
+	size_t maxBytes;
+	size_t usedBytes;
+	std::chrono::milliseconds defaultTtl;
+
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long evictions;
+
+	static size_t resultBytes( const _Query &query );
+	static std::string makeKey( const std::string &database, const std::string &queryBuffer );
+	void erase( std::list< Entry >::iterator entry );
+public:
+	_QueryCache( const size_t maxBytes, const std::chrono::milliseconds defaultTtl );
+
+	static std::string normalize( const std::string &queryBuffer );
+
+	//Results are kept per database, since the same text can read different tables in each.
+	//Returns the cached result, or an empty pointer if there is none that is still fresh.
+	ConstQuery find( const std::string &database, const std::string &queryBuffer );
+	//Cache a buffered result. Queries without a result set, and streaming queries, are not kept.
+	void insert( const std::string &database, const std::string &queryBuffer, Query query, const std::vector< std::string > &tables,
+		const std::chrono::milliseconds ttl = std::chrono::milliseconds(0) );
+
+	//Drop every result cached under this table.
+	void invalidate( const std::string &table );
+	void clear();
+
+	void setMaxBytes( const size_t maxBytes );
+	size_t getMaxBytes() { return maxBytes; }
+	size_t getUsedBytes();
+	size_t size();
+	unsigned long long getHits();
+	unsigned long long getMisses();
+	unsigned long long getEvictions();
+};
+
+//A connection checked out of a ConnectionPool. The connection goes back to the pool when
+//	the handle is destroyed or released, so it is used by one owner at a time.
+class PooledConnection
+{
+private:
+	ConnectionPool pool;
+	Connection connection;
+public:
+	PooledConnection() {}
+	PooledConnection( ConnectionPool pool, Connection connection );
+	PooledConnection( PooledConnection &&other );
+	PooledConnection &operator=( PooledConnection &&other );
+	PooledConnection( const PooledConnection & ) = delete;
+	PooledConnection &operator=( const PooledConnection & ) = delete;
+	~PooledConnection();
+
+	_Connection *operator->() const { return connection.get(); }
+	_Connection &operator*() const { return *connection; }
+	explicit operator bool() const { return connection != NULL; }
+	Connection get() const { return connection; }
+
+	//Return the connection to the pool before the handle goes out of scope.
+	void release();
+};
+
+//A thread-safe set of open connections created from one _Context. Idle connections are reused
+//	most recently returned first, pinged before reuse once they have sat idle for a while,
+//	and closed after idleTimeout while the pool holds more than its minimum.
+class _ConnectionPool : public std::enable_shared_from_this< _ConnectionPool >
+{
+private:
+	struct IdleConnection
+	{
+		Connection connection;
+		std::chrono::steady_clock::time_point returned;
+	};
+
+	std::weak_ptr< _Context > context;
+	std::mutex mutex;
+	std::condition_variable connectionReturned;
+	std::vector< IdleConnection > idle;	//Most recently returned at the back.
+	unsigned int minSize;
+	unsigned int maxSize;
+	unsigned int openConnections;	//Idle, checked out, or being opened.
+
+	std::chrono::milliseconds idleTimeout;
+	std::chrono::milliseconds waitTimeout;
+	std::chrono::milliseconds healthCheckInterval;
+
+	friend class PooledConnection;
+
+	Connection openConnection();
+	void checkin( Connection connection );
+	void collectExpired( std::vector< Connection > &expired );
+public:
+	_ConnectionPool( Context context, const unsigned int minSize, const unsigned int maxSize );
+
+	//Borrow a connection, waiting up to the wait timeout for one to be returned when the pool
+	//	is at its maximum size. Throws a ConnectionException if none becomes available.
+	PooledConnection checkout();
+
+	void setIdleTimeout( const std::chrono::milliseconds timeout );
+	void setWaitTimeout( const std::chrono::milliseconds timeout );
+	void setHealthCheckInterval( const std::chrono::milliseconds interval );
+
+	//Close connections that have been idle longer than the idle timeout, down to the minimum size.
+	void evictIdleConnections();
+
+	unsigned int getOpenConnections();
+	unsigned int getIdleConnections();
+	unsigned int getMinSize() { return minSize; }
+	unsigned int getMaxSize() { return maxSize; }
+};
+
+//The worker threads behind a pipelined BatchInsertStatement. Batches are queued in the order
+//	they were built and taken by whichever worker is free. Their buffers are recycled, so
+//	submitting a batch copies it without allocating once the pipeline is warmed up.
+class _InsertPipeline
+{
+private:
+	PipelineOptions options;
+	std::vector< PooledConnection > leases;	//Keeps pooled worker connections checked out.
+	std::vector< Connection > connections;
+	std::vector< std::thread > workers;
+	size_t maxPacketSize;
+
+	std::mutex mutex;
+	std::condition_variable batchQueued;
+	std::condition_variable spaceAvailable;
+	std::deque< std::string > queued;
+	std::vector< std::string > spareBuffers;
+	std::condition_variable batchSent;
+	unsigned int sending;	//Workers in the middle of sending a batch.
+	bool stopping;
+	bool commit;	//Whether the workers commit or roll back their transactions when stopping.
+	std::exception_ptr error;	//The first failure. No batch is sent after it.
+
+	void startWorkers();
+	void run( Connection connection );
+	void stop( const bool commit );
+public:
+	_InsertPipeline( ConnectionPool pool, const PipelineOptions &options );
+	_InsertPipeline( Connection connection, const PipelineOptions &options );
+	//Without finish(), queued batches are dropped and transactions rolled back.
+	~_InsertPipeline();
+
+	//Queue a copy of the batch, waiting while maxQueuedBatches are already queued.
+	//	Throws the first failure of an earlier batch, if there was one.
+	void submit( const char *batch, const size_t length );
+
+	//Send everything queued, commit any transactions and stop the workers. Throws the first
+	//	failure, if there was one, in which case transactions are rolled back instead.
+	void finish();
+
+	size_t getMaxPacketSize() { return maxPacketSize; }
+	size_t getQueuedBatches();
 };
 
 }